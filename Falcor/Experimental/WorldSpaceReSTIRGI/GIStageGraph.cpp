@@ -0,0 +1,117 @@
+#include "stdafx.h"
+#include "GIStageGraph.h"
+
+namespace Falcor
+{
+    uint32_t GIStageGraph::addStage(const std::string& name, const ResourceList& reads, const ResourceList& writes, ExecuteFunc func)
+    {
+        Stage stage;
+        stage.name = name;
+        stage.reads = reads;
+        stage.writes = writes;
+        stage.func = std::move(func);
+
+        mStages.push_back(std::move(stage));
+        mCompiled = false;
+        return static_cast<uint32_t>(mStages.size() - 1);
+    }
+
+    void GIStageGraph::compile()
+    {
+        /// per resource the last writer and the readers since, so a stage only depends on the stages it actually races with
+        struct Access
+        {
+            int32_t lastWriter = -1;
+            std::vector<uint32_t> readers;
+        };
+        std::unordered_map<const Resource*, Access> accesses;
+
+        mLevels.clear();
+        for (uint32_t i = 0; i < mStages.size(); i++)
+        {
+            Stage& stage = mStages[i];
+            stage.dependencies.clear();
+
+            for (const Resource* pRes : stage.reads)
+            {
+                const Access& access = accesses[pRes];
+                if (access.lastWriter >= 0) stage.dependencies.push_back(static_cast<uint32_t>(access.lastWriter));
+            }
+            for (const Resource* pRes : stage.writes)
+            {
+                const Access& access = accesses[pRes];
+                if (access.lastWriter >= 0) stage.dependencies.push_back(static_cast<uint32_t>(access.lastWriter));
+                stage.dependencies.insert(stage.dependencies.end(), access.readers.begin(), access.readers.end());
+            }
+
+            std::sort(stage.dependencies.begin(), stage.dependencies.end());
+            stage.dependencies.erase(std::unique(stage.dependencies.begin(), stage.dependencies.end()), stage.dependencies.end());
+            stage.dependencies.erase(std::remove(stage.dependencies.begin(), stage.dependencies.end(), i), stage.dependencies.end());
+
+            for (const Resource* pRes : stage.reads) accesses[pRes].readers.push_back(i);
+            for (const Resource* pRes : stage.writes)
+            {
+                accesses[pRes].lastWriter = static_cast<int32_t>(i);
+                accesses[pRes].readers.clear();
+            }
+
+            /// dependencies always come earlier in program order, so their level is already known
+            stage.level = 0;
+            for (uint32_t dep : stage.dependencies) stage.level = std::max(stage.level, mStages[dep].level + 1);
+
+            if (stage.level >= mLevels.size()) mLevels.resize(stage.level + 1);
+            mLevels[stage.level].push_back(i);
+        }
+
+        assert(validate());
+        mCompiled = true;
+    }
+
+    void GIStageGraph::execute(RenderContext* pRenderContext)
+    {
+        if (!mCompiled) compile();
+
+        /// all levels go to the given context in order, resource state tracking inserts the barriers between them
+        for (const auto& level : mLevels)
+        {
+            for (uint32_t i : level) mStages[i].func(pRenderContext);
+        }
+    }
+
+    void GIStageGraph::clear()
+    {
+        mStages.clear();
+        mLevels.clear();
+        mCompiled = false;
+    }
+
+    bool GIStageGraph::hasHazard(const Stage& first, const Stage& second)
+    {
+        auto overlaps = [](const ResourceList& a, const ResourceList& b)
+        {
+            for (const Resource* pRes : a)
+            {
+                if (std::find(b.begin(), b.end(), pRes) != b.end()) return true;
+            }
+            return false;
+        };
+
+        return overlaps(first.writes, second.reads) || overlaps(first.reads, second.writes) || overlaps(first.writes, second.writes);
+    }
+
+    bool GIStageGraph::validate() const
+    {
+        for (uint32_t i = 0; i < mStages.size(); i++)
+        {
+            for (uint32_t j = i + 1; j < mStages.size(); j++)
+            {
+                if (hasHazard(mStages[i], mStages[j]) && mStages[i].level >= mStages[j].level)
+                {
+                    logError("GIStageGraph: stage '" + mStages[j].name + "' is not ordered after '" + mStages[i].name + "'");
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Falcor.h"
+
+namespace Falcor
+{
+    /// <summary>
+    /// per-frame dependency graph of the GI stages (tracing, resampling, hash grid build, shading).
+    /// stages are recorded in program order with the resources they read and write, compile() adds an edge for every
+    /// read-after-write, write-after-read and write-after-write hazard and groups the stages into levels.
+    /// levels run one after the other on the pass's RenderContext, there is no second queue to overlap them on.
+    /// </summary>
+    class dlldecl GIStageGraph
+    {
+    public:
+        using SharedPtr = std::shared_ptr<GIStageGraph>;
+        using ExecuteFunc = std::function<void(RenderContext* pRenderContext)>;
+        using ResourceList = std::vector<const Resource*>;
+
+        static SharedPtr create() { return SharedPtr(new GIStageGraph()); }
+
+        /// resources captured by the stage must be bound inside func, stages run after the whole frame is recorded
+        uint32_t addStage(const std::string& name, const ResourceList& reads, const ResourceList& writes, ExecuteFunc func);
+
+        void compile();
+        void execute(RenderContext* pRenderContext);     /// compiles if needed, runs level by level in recording order
+        void clear();
+
+        uint32_t getStageCount() const { return static_cast<uint32_t>(mStages.size()); }
+        const std::string& getStageName(uint32_t stage) const { return mStages[stage].name; }
+        const std::vector<uint32_t>& getDependencies(uint32_t stage) const { return mStages[stage].dependencies; }
+        const std::vector<std::vector<uint32_t>>& getLevels() const { return mLevels; }
+
+        /// true if every hazard of the recorded program order is kept by the levels, for debugging the declarations
+        bool validate() const;
+
+    private:
+        GIStageGraph() = default;
+
+        struct Stage
+        {
+            std::string name;
+            ResourceList reads;
+            ResourceList writes;
+            ExecuteFunc func;
+
+            std::vector<uint32_t> dependencies;
+            uint32_t level = 0;
+        };
+
+        static bool hasHazard(const Stage& first, const Stage& second);
+
+        std::vector<Stage> mStages;
+        std::vector<std::vector<uint32_t>> mLevels;
+        bool mCompiled = false;
+    };
+}
@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "HashInsertionSimulator.h"
+
+namespace Falcor
+{
+    namespace
+    {
+        const uint32_t kDumpMagic = 0x48494753;      /// 'SGIH'
+        const uint32_t kDumpVersion = 1;
+
+        struct DumpHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint2 frameDim;
+            uint2 tileDim;
+        };
+    }
+
+    HashInsertionSimulator::Stats HashInsertionSimulator::simulate(const Frame& frame, uint32_t waveSize)
+    {
+        Stats stats;
+        if (frame.data.size() < size_t(frame.frameDim.x) * frame.frameDim.y || waveSize == 0) return stats;
+
+        uint2 tileDim = frame.tileDim.x > 0 && frame.tileDim.y > 0 ? frame.tileDim : frame.frameDim;
+        std::vector<uint32_t> waveCells;
+        waveCells.reserve(waveSize);
+
+        /// same tile walk as WorldSpaceReSTIRGIPass::execute, edge tiles are clipped to the frame
+        for (uint32_t tileY = 0; tileY < frame.frameDim.y; tileY += tileDim.y)
+        {
+            for (uint32_t tileX = 0; tileX < frame.frameDim.x; tileX += tileDim.x)
+            {
+                uint32_t width = std::min(tileDim.x, frame.frameDim.x - tileX);
+                uint32_t height = std::min(tileDim.y, frame.frameDim.y - tileY);
+
+                for (uint32_t groupY = 0; groupY < height; groupY += kGroupSize)
+                {
+                    for (uint32_t groupX = 0; groupX < width; groupX += kGroupSize)
+                    {
+                        /// lanes of a group are numbered row by row and cut into waves, threads outside the tile return early
+                        for (uint32_t waveStart = 0; waveStart < kGroupSize * kGroupSize; waveStart += waveSize)
+                        {
+                            waveCells.clear();
+                            for (uint32_t lane = waveStart; lane < std::min(waveStart + waveSize, kGroupSize * kGroupSize); lane++)
+                            {
+                                uint32_t x = groupX + lane % kGroupSize;
+                                uint32_t y = groupY + lane / kGroupSize;
+                                if (x >= width || y >= height) continue;
+
+                                const AppendData& data = frame.data[size_t(tileY + y) * frame.frameDim.x + tileX + x];
+                                if (!data.isValid) continue;
+
+                                uint32_t probes = data.cellIdx % kBucketSize + 1;
+                                stats.validLanes++;
+                                stats.perLaneProbes += probes;
+                                stats.perLaneAdds++;
+
+                                if (std::find(waveCells.begin(), waveCells.end(), data.cellIdx) == waveCells.end())
+                                {
+                                    waveCells.push_back(data.cellIdx);
+                                    stats.cooperativeProbes += probes;
+                                    stats.cooperativeAdds++;
+                                }
+                            }
+
+                            if (!waveCells.empty()) stats.waves++;
+                            stats.maxCellsPerWave = std::max(stats.maxCellsPerWave, static_cast<uint32_t>(waveCells.size()));
+                        }
+                    }
+                }
+            }
+        }
+
+        return stats;
+    }
+
+    bool HashInsertionSimulator::save(const std::string& path, const Frame& frame)
+    {
+        size_t count = size_t(frame.frameDim.x) * frame.frameDim.y;
+        if (frame.data.size() < count) return false;
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+
+        DumpHeader header = { kDumpMagic, kDumpVersion, frame.frameDim, frame.tileDim };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(frame.data.data()), count * sizeof(AppendData));
+        return file.good();
+    }
+
+    bool HashInsertionSimulator::load(const std::string& path, Frame& frame)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+
+        DumpHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+        if (header.magic != kDumpMagic || header.version != kDumpVersion)
+        {
+            logWarning("HashInsertionSimulator: '" + path + "' is not a hash append data dump");
+            return false;
+        }
+
+        frame.frameDim = header.frameDim;
+        frame.tileDim = header.tileDim;
+        frame.data.resize(size_t(header.frameDim.x) * header.frameDim.y);
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(frame.data.data()), frame.data.size() * sizeof(AppendData)));
+    }
+}
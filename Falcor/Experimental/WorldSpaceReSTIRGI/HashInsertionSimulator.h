@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Falcor.h"
+
+namespace Falcor
+{
+    /// <summary>
+    /// replays one frame of the hash grid append buffer on the CPU and counts the atomics both insertion paths of
+    /// InitialReservoirs.cs.slang issue: every lane probing and adding on its own, or one probe chain and one add
+    /// per distinct cell of a wave (GI_WAVE_COOPERATIVE_INSERTION). lanes are assigned to waves in the order of the
+    /// 16x16 groups the tile is dispatched with.
+    /// </summary>
+    class dlldecl HashInsertionSimulator
+    {
+    public:
+        static const uint32_t kGroupSize = 16;         /// numthreads of InitialReservoirs.cs.slang
+        static const uint32_t kBucketSize = 32;        /// slots probed per hash bucket by InsertCell
+
+        /// same layout as HashAppendData in HashBuildStructure.slang
+        struct AppendData
+        {
+            uint32_t isValid = 0;
+            uint32_t reservoirIdx = 0;
+            uint32_t cellIdx = 0;
+            uint32_t inCellIdx = 0;
+        };
+
+        struct Frame
+        {
+            uint2 frameDim = uint2(0u);
+            uint2 tileDim = uint2(0u);          /// tile size the frame was inserted with, decides which pixels share a wave
+            std::vector<AppendData> data;       /// frameDim.x * frameDim.y entries in linear pixel order
+        };
+
+        struct Stats
+        {
+            uint64_t waves = 0;                 /// waves with at least one inserting lane
+            uint64_t validLanes = 0;
+            uint64_t perLaneProbes = 0;         /// InterlockedCompareExchange issued when every lane runs FindOrInsertCell
+            uint64_t perLaneAdds = 0;           /// InterlockedAdd on cellCounters, one per lane
+            uint64_t cooperativeProbes = 0;     /// one probe chain per distinct cell of a wave
+            uint64_t cooperativeAdds = 0;       /// one add per distinct cell of a wave
+            uint32_t maxCellsPerWave = 0;       /// WaveReadLaneFirst rounds of the slowest wave
+        };
+
+        /// <summary>
+        /// a lane that ended in slot cellIdx probed cellIdx % kBucketSize + 1 slots, slots are never freed during a frame
+        /// so this holds whatever order the lanes ran in. lanes whose insertion failed are stored invalid and
+        /// can't be told apart from lanes that didn't insert, their 32 probes are not counted.
+        /// </summary>
+        static Stats simulate(const Frame& frame, uint32_t waveSize = 32);
+
+        /// raw dump: magic, version, frameDim, tileDim, then the append buffer
+        static bool save(const std::string& path, const Frame& frame);
+        static bool load(const std::string& path, Frame& frame);
+    };
+}
@@ -0,0 +1,647 @@
+#include "stdafx.h"
+#include "ReservoirKernels.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define RESERVOIR_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define RESERVOIR_KERNELS_X86 0
+#endif
+
+/// msvc accepts avx2 intrinsics without /arch:AVX2, other compilers only get the avx2 path when the file is built with it
+#if RESERVOIR_KERNELS_X86 && (defined(_MSC_VER) || defined(__AVX2__))
+#define RESERVOIR_KERNELS_AVX2 1
+#else
+#define RESERVOIR_KERNELS_AVX2 0
+#endif
+
+namespace Falcor
+{
+    namespace
+    {
+        /// lanes per task, a multiple of every simd width so only the last task has a scalar tail
+        const size_t kTaskSize = 16384;
+
+        struct ScalarOps
+        {
+            using F = float;
+            using U = uint32_t;
+            static constexpr size_t kWidth = 1;
+
+            static F loadF(const float* p) { return *p; }
+            static void storeF(float* p, F v) { *p = v; }
+            static U loadU(const uint32_t* p) { return *p; }
+            static void storeU(uint32_t* p, U v) { *p = v; }
+            static F setF(float v) { return v; }
+            static U setU(uint32_t v) { return v; }
+
+            static F add(F a, F b) { return a + b; }
+            static F sub(F a, F b) { return a - b; }
+            static F mul(F a, F b) { return a * b; }
+            static F div(F a, F b) { return a / b; }
+            static F max(F a, F b) { return a > b ? a : b; }        /// same operand order as maxps, a nan in a yields b
+            static F min(F a, F b) { return a < b ? a : b; }
+            static F sqrt(F a) { return std::sqrt(a); }
+            static F toF(U a) { return static_cast<float>(static_cast<int32_t>(a)); }
+
+            static U cmpLe(F a, F b) { return a <= b ? ~0u : 0u; }
+            static U cmpLt(F a, F b) { return a < b ? ~0u : 0u; }
+            static U cmpEqU(U a, U b) { return a == b ? ~0u : 0u; }
+
+            static U andU(U a, U b) { return a & b; }
+            static U orU(U a, U b) { return a | b; }
+            static U xorU(U a, U b) { return a ^ b; }
+            static U andNotU(U a, U b) { return ~a & b; }
+            static U addU(U a, U b) { return a + b; }
+            template<int n> static U shl(U a) { return a << n; }
+            template<int n> static U shr(U a) { return a >> n; }
+
+            static F select(U m, F a, F b) { return m ? a : b; }
+            static U selectU(U m, U a, U b) { return m ? a : b; }
+        };
+
+#if RESERVOIR_KERNELS_X86
+        struct SseOps
+        {
+            using F = __m128;
+            using U = __m128i;
+            static constexpr size_t kWidth = 4;
+
+            static F loadF(const float* p) { return _mm_loadu_ps(p); }
+            static void storeF(float* p, F v) { _mm_storeu_ps(p, v); }
+            static U loadU(const uint32_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+            static void storeU(uint32_t* p, U v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+            static F setF(float v) { return _mm_set1_ps(v); }
+            static U setU(uint32_t v) { return _mm_set1_epi32(static_cast<int>(v)); }
+
+            static F add(F a, F b) { return _mm_add_ps(a, b); }
+            static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+            static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+            static F div(F a, F b) { return _mm_div_ps(a, b); }
+            static F max(F a, F b) { return _mm_max_ps(a, b); }
+            static F min(F a, F b) { return _mm_min_ps(a, b); }
+            static F sqrt(F a) { return _mm_sqrt_ps(a); }
+            static F toF(U a) { return _mm_cvtepi32_ps(a); }
+
+            static U cmpLe(F a, F b) { return _mm_castps_si128(_mm_cmple_ps(a, b)); }
+            static U cmpLt(F a, F b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+            static U cmpEqU(U a, U b) { return _mm_cmpeq_epi32(a, b); }
+
+            static U andU(U a, U b) { return _mm_and_si128(a, b); }
+            static U orU(U a, U b) { return _mm_or_si128(a, b); }
+            static U xorU(U a, U b) { return _mm_xor_si128(a, b); }
+            static U andNotU(U a, U b) { return _mm_andnot_si128(a, b); }
+            static U addU(U a, U b) { return _mm_add_epi32(a, b); }
+            template<int n> static U shl(U a) { return _mm_slli_epi32(a, n); }
+            template<int n> static U shr(U a) { return _mm_srli_epi32(a, n); }
+
+            static F select(U m, F a, F b) { F mf = _mm_castsi128_ps(m); return _mm_or_ps(_mm_and_ps(mf, a), _mm_andnot_ps(mf, b)); }
+            static U selectU(U m, U a, U b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+        };
+#endif
+
+#if RESERVOIR_KERNELS_AVX2
+        struct Avx2Ops
+        {
+            using F = __m256;
+            using U = __m256i;
+            static constexpr size_t kWidth = 8;
+
+            static F loadF(const float* p) { return _mm256_loadu_ps(p); }
+            static void storeF(float* p, F v) { _mm256_storeu_ps(p, v); }
+            static U loadU(const uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+            static void storeU(uint32_t* p, U v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+            static F setF(float v) { return _mm256_set1_ps(v); }
+            static U setU(uint32_t v) { return _mm256_set1_epi32(static_cast<int>(v)); }
+
+            static F add(F a, F b) { return _mm256_add_ps(a, b); }
+            static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+            static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+            static F div(F a, F b) { return _mm256_div_ps(a, b); }
+            static F max(F a, F b) { return _mm256_max_ps(a, b); }
+            static F min(F a, F b) { return _mm256_min_ps(a, b); }
+            static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+            static F toF(U a) { return _mm256_cvtepi32_ps(a); }
+
+            static U cmpLe(F a, F b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+            static U cmpLt(F a, F b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+            static U cmpEqU(U a, U b) { return _mm256_cmpeq_epi32(a, b); }
+
+            static U andU(U a, U b) { return _mm256_and_si256(a, b); }
+            static U orU(U a, U b) { return _mm256_or_si256(a, b); }
+            static U xorU(U a, U b) { return _mm256_xor_si256(a, b); }
+            static U andNotU(U a, U b) { return _mm256_andnot_si256(a, b); }
+            static U addU(U a, U b) { return _mm256_add_epi32(a, b); }
+            template<int n> static U shl(U a) { return _mm256_slli_epi32(a, n); }
+            template<int n> static U shr(U a) { return _mm256_srli_epi32(a, n); }
+
+            static F select(U m, F a, F b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(m)); }
+            static U selectU(U m, U a, U b) { return _mm256_blendv_epi8(b, a, m); }
+        };
+#endif
+
+        template<typename V, int k>
+        typename V::U rotl(typename V::U x)
+        {
+            return V::orU(V::template shl<k>(x), V::template shr<32 - k>(x));
+        }
+
+        /// Xoshiro128StarStar::nextRandom, the multiplications by 5 and 9 are done with shifts so sse2 is enough
+        template<typename V>
+        typename V::U nextRandom(typename V::U s[4])
+        {
+            using U = typename V::U;
+            U times5 = V::addU(V::template shl<2>(s[0]), s[0]);
+            U rotated = rotl<V, 7>(times5);
+            U result = V::addU(V::template shl<3>(rotated), rotated);
+            U t = V::template shl<9>(s[1]);
+
+            s[2] = V::xorU(s[2], s[0]);
+            s[3] = V::xorU(s[3], s[1]);
+            s[1] = V::xorU(s[1], s[2]);
+            s[0] = V::xorU(s[0], s[3]);
+
+            s[2] = V::xorU(s[2], t);
+            s[3] = rotl<V, 11>(s[3]);
+
+            return result;
+        }
+
+        template<typename V>
+        typename V::F luminance(typename V::F r, typename V::F g, typename V::F b)
+        {
+            return V::add(V::add(V::mul(r, V::setF(0.299f)), V::mul(g, V::setF(0.587f))), V::mul(b, V::setF(0.114f)));
+        }
+
+        template<typename V>
+        typename V::F dot(const typename V::F a[3], const typename V::F b[3])
+        {
+            return V::add(V::add(V::mul(a[0], b[0]), V::mul(a[1], b[1])), V::mul(a[2], b[2]));
+        }
+
+        template<typename V>
+        void load3(const std::vector<float> v[3], size_t i, typename V::F out[3])
+        {
+            for (uint32_t c = 0; c < 3; c++) out[c] = V::loadF(&v[c][i]);
+        }
+
+        ReservoirKernels::Isa& currentIsa()
+        {
+            static ReservoirKernels::Isa isa = ReservoirKernels::getSupportedIsa();
+            return isa;
+        }
+
+        /// <summary>
+        /// workers sleep between batches instead of being spawned per call, the calling thread takes tasks as well.
+        /// the pool is owned by ReservoirKernels::shutdown rather than a static, joining threads from a static
+        /// destructor runs under the loader lock when the dll unloads.
+        /// </summary>
+        class TaskPool
+        {
+        public:
+            using Task = std::function<void(size_t task)>;
+
+            TaskPool()
+            {
+                uint32_t workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+                for (uint32_t i = 0; i < workerCount; i++) mWorkers.emplace_back([this]() { workerLoop(); });
+            }
+
+            ~TaskPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mStop = true;
+                }
+                mWake.notify_all();
+                for (auto& worker : mWorkers) worker.join();
+            }
+
+            /// not reentrant, the caller holds poolMutex()
+            void run(size_t taskCount, const Task& task)
+            {
+                Batch batch;
+                batch.pTask = &task;
+                batch.taskCount = taskCount;
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mpBatch = &batch;
+                    mGeneration++;
+                }
+                mWake.notify_all();
+
+                work(batch);
+
+                /// workers that picked up the batch may still be running their last task, batch lives on this stack
+                std::unique_lock<std::mutex> lock(mMutex);
+                mpBatch = nullptr;
+                mDone.wait(lock, [this]() { return mActiveWorkers == 0; });
+            }
+
+        private:
+            struct Batch
+            {
+                const Task* pTask = nullptr;
+                size_t taskCount = 0;
+                std::atomic<size_t> nextTask{ 0 };
+            };
+
+            static void work(Batch& batch)
+            {
+                for (size_t task = batch.nextTask++; task < batch.taskCount; task = batch.nextTask++) (*batch.pTask)(task);
+            }
+
+            void workerLoop()
+            {
+                uint64_t generation = 0;
+                for (;;)
+                {
+                    Batch* pBatch = nullptr;
+                    {
+                        std::unique_lock<std::mutex> lock(mMutex);
+                        mWake.wait(lock, [&]() { return mStop || mGeneration != generation; });
+                        if (mStop) return;
+                        generation = mGeneration;
+                        /// null if the batch finished before this worker woke up
+                        pBatch = mpBatch;
+                        if (!pBatch) continue;
+                        mActiveWorkers++;
+                    }
+
+                    work(*pBatch);
+
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    if (--mActiveWorkers == 0) mDone.notify_all();
+                }
+            }
+
+            std::vector<std::thread> mWorkers;
+            std::mutex mMutex;
+            std::condition_variable mWake;
+            std::condition_variable mDone;
+            Batch* mpBatch = nullptr;
+            uint64_t mGeneration = 0;
+            uint32_t mActiveWorkers = 0;
+            bool mStop = false;
+        };
+
+        /// serializes batches from different threads against each other and against shutdown
+        std::mutex& poolMutex()
+        {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        /// deliberately a raw pointer, without shutdown() the pool is left to process exit instead of being joined
+        TaskPool*& poolInstance()
+        {
+            static TaskPool* pPool = nullptr;
+            return pPool;
+        }
+
+        template<typename Func>
+        void parallelFor(size_t count, Func&& func)
+        {
+            size_t taskCount = (count + kTaskSize - 1) / kTaskSize;
+            if (taskCount <= 1)
+            {
+                func(size_t(0), count);
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(poolMutex());
+            TaskPool*& pPool = poolInstance();
+            if (!pPool) pPool = new TaskPool();
+            pPool->run(taskCount, [&](size_t task)
+            {
+                func(task * kTaskSize, std::min(count, (task + 1) * kTaskSize));
+            });
+        }
+
+        template<typename V, typename Kernel>
+        void runRange(size_t begin, size_t end, Kernel& kernel)
+        {
+            size_t i = begin;
+            for (; i + V::kWidth <= end; i += V::kWidth) kernel(V(), i);
+            for (; i < end; i++) kernel(ScalarOps(), i);
+        }
+
+        /// kernel is called as kernel(ops, firstLane) and processes ops.kWidth lanes
+        template<typename Kernel>
+        void dispatch(size_t count, Kernel&& kernel)
+        {
+            ReservoirKernels::Isa isa = currentIsa();
+            parallelFor(count, [&](size_t begin, size_t end)
+            {
+                switch (isa)
+                {
+#if RESERVOIR_KERNELS_AVX2
+                case ReservoirKernels::Isa::AVX2: runRange<Avx2Ops>(begin, end, kernel); break;
+#endif
+#if RESERVOIR_KERNELS_X86
+                case ReservoirKernels::Isa::SSE: runRange<SseOps>(begin, end, kernel); break;
+#endif
+                default: runRange<ScalarOps>(begin, end, kernel); break;
+                }
+            });
+        }
+
+        uint32_t interleave_32bit(uint2 v)
+        {
+            uint32_t x = v.x & 0x0000ffff;
+            uint32_t y = v.y & 0x0000ffff;
+
+            x = (x | (x << 8)) & 0x00FF00FF;
+            x = (x | (x << 4)) & 0x0F0F0F0F;
+            x = (x | (x << 2)) & 0x33333333;
+            x = (x | (x << 1)) & 0x55555555;
+
+            y = (y | (y << 8)) & 0x00FF00FF;
+            y = (y | (y << 4)) & 0x0F0F0F0F;
+            y = (y | (y << 2)) & 0x33333333;
+            y = (y | (y << 1)) & 0x55555555;
+
+            return x | (y << 1);
+        }
+
+        uint64_t nextSplitMix64(uint64_t& state)
+        {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        /// SolidAngleToArea / AreaToSolidAngle of GIReservoir.slang applied to weightF
+        void convertMeasure(ReservoirKernels::ReservoirBatch& batch, bool toArea)
+        {
+            dispatch(batch.size(), [&](auto ops, size_t i)
+            {
+                using V = decltype(ops);
+                using F = typename V::F;
+                using U = typename V::U;
+
+                F vPos[3], sPos[3], sNorm[3], offset[3];
+                load3<V>(batch.vPos, i, vPos);
+                load3<V>(batch.sPos, i, sPos);
+                load3<V>(batch.sNorm, i, sNorm);
+                for (uint32_t c = 0; c < 3; c++) offset[c] = V::sub(vPos[c], sPos[c]);
+
+                F dist2 = dot<V>(offset, offset);
+                F cosS = V::div(dot<V>(sNorm, offset), V::sqrt(dist2));
+                U valid = V::andU(V::cmpLt(V::setF(0.f), dist2), V::cmpLt(V::setF(0.f), cosS));
+
+                F jacobian = toArea ? V::div(dist2, cosS) : V::div(cosS, dist2);
+                F weightF = V::loadF(&batch.weightF[i]);
+                V::storeF(&batch.weightF[i], V::mul(weightF, V::select(valid, jacobian, V::setF(0.f))));
+            });
+        }
+    }
+
+    void ReservoirKernels::ReservoirBatch::resize(size_t count)
+    {
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            vPos[c].resize(count);
+            vNorm[c].resize(count);
+            sPos[c].resize(count);
+            sNorm[c].resize(count);
+            radiance[c].resize(count);
+        }
+        M.resize(count);
+        weightF.resize(count);
+        age.resize(count);
+    }
+
+    void ReservoirKernels::RngBatch::resize(size_t count)
+    {
+        for (uint32_t i = 0; i < 4; i++) state[i].resize(count);
+    }
+
+    void ReservoirKernels::RngBatch::seed(size_t lane, uint2 pixel, uint32_t sampleNumber)
+    {
+        /// UniformSampleGenerator: splitmix64 seeded with the interleaved pixel and sample number fills the xoshiro state
+        uint64_t splitMix = (uint64_t(interleave_32bit(pixel)) << 32) | uint64_t(sampleNumber);
+        uint64_t s0 = nextSplitMix64(splitMix);
+        uint64_t s1 = nextSplitMix64(splitMix);
+
+        state[0][lane] = uint32_t(s0);
+        state[1][lane] = uint32_t(s0 >> 32);
+        state[2][lane] = uint32_t(s1);
+        state[3][lane] = uint32_t(s1 >> 32);
+    }
+
+    float ReservoirKernels::RngBatch::next1D(size_t lane)
+    {
+        uint32_t s[4] = { state[0][lane], state[1][lane], state[2][lane], state[3][lane] };
+        uint32_t bits = nextRandom<ScalarOps>(s);
+        for (uint32_t i = 0; i < 4; i++) state[i][lane] = s[i];
+        return (bits >> 8) * (1.f / 16777216.f);
+    }
+
+    ReservoirKernels::Isa ReservoirKernels::getSupportedIsa()
+    {
+#if RESERVOIR_KERNELS_X86
+        bool avx2 = false;
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#else
+        avx2 = __builtin_cpu_supports("avx2");
+#endif
+        return (RESERVOIR_KERNELS_AVX2 && avx2) ? Isa::AVX2 : Isa::SSE;
+#else
+        return Isa::Scalar;
+#endif
+    }
+
+    ReservoirKernels::Isa ReservoirKernels::getIsa()
+    {
+        return currentIsa();
+    }
+
+    void ReservoirKernels::setIsa(Isa isa)
+    {
+        currentIsa() = std::min(isa, getSupportedIsa());
+    }
+
+    void ReservoirKernels::shutdown()
+    {
+        std::lock_guard<std::mutex> lock(poolMutex());
+        delete poolInstance();
+        poolInstance() = nullptr;
+    }
+
+    void ReservoirKernels::merge(ReservoirBatch& dst, std::vector<float>& weightS, const ReservoirBatch& src, const std::vector<float>& targetPdf, RngBatch& rng, const std::vector<uint32_t>* pMask, const std::vector<float>* pConfidence)
+    {
+        size_t count = dst.size();
+        assert(src.size() == count && weightS.size() == count && targetPdf.size() == count && rng.size() == count);
+        assert(!pMask || pMask->size() == count);
+        assert(!pConfidence || pConfidence->size() == count);
+
+        dispatch(count, [&](auto ops, size_t i)
+        {
+            using V = decltype(ops);
+            using F = typename V::F;
+            using U = typename V::U;
+
+            U active = pMask ? V::andNotU(V::cmpEqU(V::loadU(&(*pMask)[i]), V::setU(0)), V::setU(~0u)) : V::setU(~0u);
+
+            /// float weight = confidence * max(0.f, r.weightF) * pdf, confidence is r.M for Merge;
+            U srcM = V::loadU(&src.M[i]);
+            F confidence = pConfidence ? V::loadF(&(*pConfidence)[i]) : V::toF(srcM);
+            F weight = V::mul(V::mul(confidence, V::max(V::loadF(&src.weightF[i]), V::setF(0.f))), V::loadF(&targetPdf[i]));
+
+            F weightSOld = V::loadF(&weightS[i]);
+            F weightSNew = V::add(weightSOld, weight);
+            V::storeF(&weightS[i], V::select(active, weightSNew, weightSOld));
+
+            if (!pConfidence)
+            {
+                U dstM = V::loadU(&dst.M[i]);
+                V::storeU(&dst.M[i], V::selectU(active, V::addU(dstM, srcM), dstM));
+            }
+
+            U state[4];
+            U stateOld[4];
+            for (uint32_t j = 0; j < 4; j++) state[j] = stateOld[j] = V::loadU(&rng.state[j][i]);
+            U bits = nextRandom<V>(state);
+            for (uint32_t j = 0; j < 4; j++) V::storeU(&rng.state[j][i], V::selectU(active, state[j], stateOld[j]));
+
+            /// bool isUpdate = random * weightS <= weight;
+            F random = V::mul(V::toF(V::template shr<8>(bits)), V::setF(1.f / 16777216.f));
+            U isUpdate = V::andU(active, V::cmpLe(V::mul(random, weightSNew), weight));
+
+            auto blend = [&](std::vector<float>& d, const std::vector<float>& s)
+            {
+                V::storeF(&d[i], V::select(isUpdate, V::loadF(&s[i]), V::loadF(&d[i])));
+            };
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                blend(dst.sPos[c], src.sPos[c]);
+                blend(dst.sNorm[c], src.sNorm[c]);
+                blend(dst.radiance[c], src.radiance[c]);
+            }
+
+            uint32_t* pDstAge = reinterpret_cast<uint32_t*>(&dst.age[i]);
+            const uint32_t* pSrcAge = reinterpret_cast<const uint32_t*>(&src.age[i]);
+            V::storeU(pDstAge, V::selectU(isUpdate, V::loadU(pSrcAge), V::loadU(pDstAge)));
+        });
+    }
+
+    void ReservoirKernels::computeFinalWeight(ReservoirBatch& dst, const std::vector<float>& targetPdf, const std::vector<float>& weightS)
+    {
+        size_t count = dst.size();
+        assert(targetPdf.size() == count && weightS.size() == count);
+
+        dispatch(count, [&](auto ops, size_t i)
+        {
+            using V = decltype(ops);
+            using F = typename V::F;
+
+            /// float weight = targetPdf * M; weightF = weight > 0.f ? weightS / weight : 0.f;
+            F weight = V::mul(V::loadF(&targetPdf[i]), V::toF(V::loadU(&dst.M[i])));
+            F finalWeight = V::div(V::loadF(&weightS[i]), weight);
+            V::storeF(&dst.weightF[i], V::select(V::cmpLt(V::setF(0.f), weight), finalWeight, V::setF(0.f)));
+        });
+    }
+
+    void ReservoirKernels::toAreaMeasure(ReservoirBatch& batch)
+    {
+        convertMeasure(batch, true);
+    }
+
+    void ReservoirKernels::toSolidAngle(ReservoirBatch& batch)
+    {
+        convertMeasure(batch, false);
+    }
+
+    void ReservoirKernels::evalTargetPdf(const ReservoirBatch& batch, std::vector<float>& targetPdf)
+    {
+        size_t count = batch.size();
+        targetPdf.resize(count);
+
+        dispatch(count, [&](auto ops, size_t i)
+        {
+            using V = decltype(ops);
+            V::storeF(&targetPdf[i], luminance<V>(V::loadF(&batch.radiance[0][i]), V::loadF(&batch.radiance[1][i]), V::loadF(&batch.radiance[2][i])));
+        });
+    }
+
+    void ReservoirKernels::evalReconnection(const ReservoirBatch& receiver, const ReservoirBatch& neighbor, float normalThreshold, std::vector<float>& targetPdf, std::vector<uint32_t>& mask)
+    {
+        size_t count = receiver.size();
+        assert(neighbor.size() == count);
+        targetPdf.resize(count);
+        mask.resize(count);
+
+        dispatch(count, [&](auto ops, size_t i)
+        {
+            using V = decltype(ops);
+            using F = typename V::F;
+            using U = typename V::U;
+
+            F vPos[3], vNorm[3], nPos[3], nNorm[3], sPos[3], sNorm[3];
+            load3<V>(receiver.vPos, i, vPos);
+            load3<V>(receiver.vNorm, i, vNorm);
+            load3<V>(neighbor.vPos, i, nPos);
+            load3<V>(neighbor.vNorm, i, nNorm);
+            load3<V>(neighbor.sPos, i, sPos);
+            load3<V>(neighbor.sNorm, i, sNorm);
+
+            U skip = V::orU(V::cmpEqU(V::loadU(&neighbor.M[i]), V::setU(0)), V::cmpLt(dot<V>(vNorm, nNorm), V::setF(normalThreshold)));
+
+            F offsetB[3], offsetA[3];
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                offsetB[c] = V::sub(sPos[c], nPos[c]);
+                offsetA[c] = V::sub(sPos[c], vPos[c]);
+            }
+            /// discard back-face
+            U zero = V::cmpLe(dot<V>(vNorm, offsetA), V::setF(0.f));
+
+            F RB2 = dot<V>(offsetB, offsetB);
+            F RA2 = dot<V>(offsetA, offsetA);
+            F lengthB = V::sqrt(RB2);
+            F lengthA = V::sqrt(RA2);
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                offsetB[c] = V::div(offsetB[c], lengthB);
+                offsetA[c] = V::div(offsetA[c], lengthA);
+            }
+            F cosA = dot<V>(vNorm, offsetA);
+            F cosB = dot<V>(nNorm, offsetB);
+            F cosPhiA = V::sub(V::setF(0.f), dot<V>(offsetA, sNorm));
+            F cosPhiB = V::sub(V::setF(0.f), dot<V>(offsetB, sNorm));
+
+            skip = V::orU(skip, V::orU(V::cmpLe(cosB, V::setF(0.f)), V::cmpLe(cosPhiB, V::setF(0.f))));
+            zero = V::orU(zero, V::orU(V::cmpLe(cosA, V::setF(0.f)), V::cmpLe(cosPhiA, V::setF(0.f))));
+            zero = V::orU(zero, V::orU(V::cmpLe(RA2, V::setF(0.f)), V::cmpLe(RB2, V::setF(0.f))));
+
+            /// float jacobi = RA2 * cosPhiB <= 0.f ? 0.f : clamp(RB2 * cosPhiA / (RA2 * cosPhiB), 0.f, 10.f);
+            F denom = V::mul(RA2, cosPhiB);
+            zero = V::orU(zero, V::cmpLe(denom, V::setF(0.f)));
+            F jacobi = V::min(V::max(V::div(V::mul(RB2, cosPhiA), denom), V::setF(0.f)), V::setF(10.f));
+
+            F lum = luminance<V>(V::loadF(&neighbor.radiance[0][i]), V::loadF(&neighbor.radiance[1][i]), V::loadF(&neighbor.radiance[2][i]));
+            V::storeF(&targetPdf[i], V::select(zero, V::setF(0.f), V::mul(lum, jacobi)));
+            V::storeU(&mask[i], V::andNotU(skip, V::setU(~0u)));
+        });
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Falcor.h"
+
+namespace Falcor
+{
+    /// <summary>
+    /// CPU version of the reservoir math in GIReservoir.slang and ResampleManager, for offline use and validation.
+    /// Reservoirs are kept as structure of arrays and processed in SIMD lanes (AVX2 or SSE, scalar fallback)
+    /// picked at runtime, large batches are split across a pool of worker threads that stays alive between calls.
+    /// the pool is started on first use and only stopped by shutdown(), never by a static destructor.
+    /// </summary>
+    class dlldecl ReservoirKernels
+    {
+    public:
+        enum class Isa
+        {
+            Scalar = 0,
+            SSE = 1,
+            AVX2 = 2
+        };
+
+        /// same fields as Reservoir in GIReservoir.slang, one array per component
+        struct ReservoirBatch
+        {
+            std::vector<float> vPos[3];
+            std::vector<float> vNorm[3];
+            std::vector<float> sPos[3];
+            std::vector<float> sNorm[3];
+            std::vector<float> radiance[3];
+
+            std::vector<uint32_t> M;
+            std::vector<float> weightF;
+            std::vector<int32_t> age;
+
+            void resize(size_t count);
+            size_t size() const { return M.size(); }
+        };
+
+        /// <summary>
+        /// one xoshiro128** stream per lane, seeded like the uniform SampleGenerator so a lane seeded with
+        /// (pixel, sampleNumber) draws the same numbers as SampleGenerator(pixel, sampleNumber) on the GPU
+        /// </summary>
+        struct RngBatch
+        {
+            std::vector<uint32_t> state[4];
+
+            void resize(size_t count);
+            void seed(size_t lane, uint2 pixel, uint32_t sampleNumber);
+            float next1D(size_t lane);                  /// same as sampleNext1D
+            size_t size() const { return state[0].size(); }
+        };
+
+        static Isa getSupportedIsa();
+        static Isa getIsa();
+        static void setIsa(Isa isa);                   /// clamped to what the cpu supports, mostly to compare against the scalar path
+
+        /// joins the worker threads, the owner calls it before the dll is unloaded. the next kernel call starts a new pool
+        static void shutdown();
+
+        /// Reservoir::Merge per lane, lanes whose mask is 0 are left untouched and consume no random number.
+        /// with pConfidence it is Reservoir::MergeWeighted, src is weighted by the confidence instead of src.M and dst.M is kept
+        static void merge(ReservoirBatch& dst, std::vector<float>& weightS, const ReservoirBatch& src, const std::vector<float>& targetPdf, RngBatch& rng, const std::vector<uint32_t>* pMask = nullptr, const std::vector<float>* pConfidence = nullptr);
+
+        /// Reservoir::ComputeFinalWeight per lane
+        static void computeFinalWeight(ReservoirBatch& dst, const std::vector<float>& targetPdf, const std::vector<float>& weightS);
+
+        /// weightF *= R^2 / cos at the sample as seen from vPos (SolidAngleToArea), so reservoirs of different vPos can be merged
+        static void toAreaMeasure(ReservoirBatch& batch);
+
+        /// weightF *= cos / R^2 at the sample (AreaToSolidAngle), vPos has to be the receiver's already
+        static void toSolidAngle(ReservoirBatch& batch);
+
+        /// incoming radiance target pdf (GI_TARGET_PDF 0)
+        static void evalTargetPdf(const ReservoirBatch& batch, std::vector<float>& targetPdf);
+
+        /// <summary>
+        /// target pdf of reusing neighbor's sample at receiver's visible point, including the geometry jacobian,
+        /// as in the spatial loop of ResampleManager::execute. mask is 0 where the shader skips the neighbor,
+        /// visibility is left to the caller.
+        /// </summary>
+        static void evalReconnection(const ReservoirBatch& receiver, const ReservoirBatch& neighbor, float normalThreshold, std::vector<float>& targetPdf, std::vector<uint32_t>& mask);
+    };
+}
@@ -8,6 +8,7 @@ namespace Falcor
         const std::string& kReflectTypeFilePath = "Experimental/WorldSpaceReSTIRGI/ReflectTypes.cs.slang";
         const std::string& kInitialReservoirFilePath = "Experimental/WorldSpaceReSTIRGI/InitialReservoirs.cs.slang";
         const std::string& kBuildHashGridFilePath = "Experimental/WorldSpaceReSTIRGI/BuildHashGrid.cs.slang";
+        const std::string& kCellReservoirsFilePath = "Experimental/WorldSpaceReSTIRGI/CellReservoirs.cs.slang";
         const std::string& kGIResamplingFilePath = "Experimental/WorldSpaceReSTIRGI/SpatiotemporalResampling.cs.slang";
         const std::string& kFinalSampleFilePath = "Experimental/WorldSpaceReSTIRGI/FinalSample.cs.slang";
 
@@ -50,6 +51,9 @@ namespace Falcor
 
         defines.add("GI_TARGET_PDF", std::to_string((int)mOptions->resamplingTargetPdf));
 
+        defines.add("GI_WAVE_COOPERATIVE_INSERTION", mOptions->waveCooperativeInsertion ? "1" : "0");
+        defines.add("GI_CELL_RESERVOIRS", mOptions->preMergedCellReservoirs ? "1" : "0");
+
         return defines;
     }
 
@@ -62,10 +66,20 @@ namespace Falcor
         {
             runtimeDirty |= widget.var("Normal threshold", mOptions->normalThreshold, 0.f, 1.f);
             runtimeDirty |= widget.var("Depth threshold", mOptions->depthThreshold, 0.f, 1.f);
-            runtimeDirty |= widget.var("Cells Dimension", mOptions->sceneGridDimension, 1u, 300u);
+            runtimeDirty |= widget.var("Temporal max M", mOptions->temporalMaxM, 1u, 1000u);
+            runtimeDirty |= widget.var("Spatial max M", mOptions->spatialMaxM, 1u, 1000u);
+            runtimeDirty |= widget.var("Max reservoir age", mOptions->maxReservoirAge, 1u, 1000u);
+            runtimeDirty |= widget.var("Min cell size", mOptions->minCellSize, 0.001f, 10.f, 0.001f);
+            runtimeDirty |= widget.var("Clipmap levels", mOptions->clipmapLevels, 1u, 16u);
+            runtimeDirty |= widget.var("Clipmap resolution", mOptions->clipmapResolution, 4u, 1024u);
+            runtimeDirty |= widget.var("Tile size", mOptions->tileSize, 0u, 8192u, 64u);
+            widget.text("Tile sized buffers: " + std::to_string(GetTileSizedMemory() >> 20) + " MB, frame sized (not bounded by the tile): " + std::to_string(GetFrameSizedMemory() >> 20) + " MB");
+            if (widget.button("Capture hash insertion")) mCaptureHashInsertion = true;
 
             staticDirty |= widget.var("Roughness threshold", mOptions->roughnessThreshold, 0.f, 1.2f);
             staticDirty |= widget.dropdown("Target pdf mode", kReSTIRGIModeList, reinterpret_cast<uint32_t&>(mOptions->resamplingTargetPdf));
+            staticDirty |= widget.checkbox("Wave cooperative insertion", mOptions->waveCooperativeInsertion);
+            staticDirty |= widget.checkbox("Pre-merged cell reservoirs", mOptions->preMergedCellReservoirs);
         }
 
         if (staticDirty) mRecompile = true;
@@ -75,41 +89,90 @@ namespace Falcor
         return dirty;
     }
 
-    void WorldSpaceReSTIRGI::BeginFrame(RenderContext* pRenderContext, uint2 frameDim)
+    void WorldSpaceReSTIRGI::BeginFrame(RenderContext* pRenderContext, GIStageGraph& graph, uint2 frameDim)
     {
-        UpdateResources(frameDim);
+        uint2 allocDim = glm::max(frameDim, mOptions->maxFrameDim);
+        UpdateResources(pRenderContext, allocDim, GetTileDim(allocDim));
+
+        /// params.frameDim still holds the previous frame's size, temporal reprojection rescales from it
+        params.preFrameDim = params.frameCount > 0 ? params.frameDim : frameDim;
         params.frameDim = frameDim;
+        params.reservoirCapacity = static_cast<uint>(mpReservoirs[0]->getElementCount() / 2);
+        SetTile(uint2(0u), GetTileDim(frameDim));
         params.fov = focalLengthToFovY(mpScene->getCamera()->getFocalLength(), Camera::kDefaultFrameHeight);
-        params.sceneBBMin = mpScene->getSceneBounds().minPoint -float3(0.1, 0.1, 0.1);
 
-        float3 boudingSize = abs((mpScene->getSceneBounds().maxPoint - mpScene->getSceneBounds().minPoint) / static_cast<float>(mOptions->sceneGridDimension));
+        /// the clipmap follows the camera, snapping it to the coarsest cell keeps every level's cell boundaries fixed in world space
+        double coarsestCellSize = static_cast<double>(mOptions->minCellSize) * static_cast<double>(1u << (mOptions->clipmapLevels - 1));
+        glm::dvec3 originCell = glm::floor(glm::dvec3(mpScene->getCamera()->getPosition()) / coarsestCellSize);
 
         params._pad = float4(0, 0, 0,0);
-        params.minCellSize = std::max(boudingSize.x, std::max(boudingSize.y, boudingSize.z));
+        params.minCellSize = mOptions->minCellSize;
+        params.clipmapLevels = mOptions->clipmapLevels;
+        params.clipmapResolution = mOptions->clipmapResolution;
+        params.clipmapOriginCell = int3(originCell);
+        params.clipmapOrigin = float3(originCell * coarsestCellSize);
 
         //std::cout << params.minCellSize <<" ";
 
-        pRenderContext->clearUAV(mpCheckSumBuffer[(params.frameCount + 1) % 2]->getUAV().get(), uint4(0));
-        pRenderContext->clearUAV(mpCellCounter[(params.frameCount + 1) % 2]->getUAV().get(), uint4(0));
-        pRenderContext->clearUAV(mpIndexBuffer[(params.frameCount + 1) % 2]->getUAV().get(), uint4(0));
-      
+        uint current = (params.frameCount + 1) % 2;
+        graph.addStage("ClearHashGrid",
+            {},
+            { mpCheckSumBuffer[current].get(), mpCellCounter[current].get(), mpIndexBuffer[current].get() },
+            [this, frameParams = params](RenderContext* pRenderContext) { ClearHashGridPass(pRenderContext, frameParams); });
+    }
+
+    void WorldSpaceReSTIRGI::SetTile(uint2 tileOffset, uint2 tileDim)
+    {
+        params.tileOffset = tileOffset;
+        params.tileDim = tileDim;
+    }
+
+    uint2 WorldSpaceReSTIRGI::GetTileDim(uint2 frameDim) const
+    {
+        return mOptions->tileSize > 0u ? glm::min(frameDim, uint2(mOptions->tileSize)) : frameDim;
+    }
+
+    uint64_t WorldSpaceReSTIRGI::GetTileSizedMemory() const
+    {
+        uint64_t size = 0;
+        for (const auto& pBuffer : { mpInitialReservoir, mpFinalSample })
+        {
+            if (pBuffer) size += pBuffer->getSize();
+        }
+        return size;
+    }
+
+    uint64_t WorldSpaceReSTIRGI::GetFrameSizedMemory() const
+    {
+        uint64_t size = mpAppendBuffer ? mpAppendBuffer->getSize() : 0;
+        for (uint32_t i = 0; i < 2; i++)
+        {
+            for (const auto& pBuffer : { mpReservoirs[i], mpCellStorage[i], mpCellReservoirs[i] })
+            {
+                if (pBuffer) size += pBuffer->getSize();
+            }
+        }
+        if (mpCellList) size += mpCellList->getSize();
+        return size;
     }
 
-    void WorldSpaceReSTIRGI::UpdateResources(uint2 frameDim)
+    void WorldSpaceReSTIRGI::UpdateResources(RenderContext* pRenderContext, uint2 frameDim, uint2 tileDim)
     {
+        /// buffers only grow, shaders index them by the active frameDim so a smaller frame reuses the allocation
         uint32_t elementCount = frameDim.x * frameDim.y;
+        uint32_t tileElementCount = tileDim.x * tileDim.y;
 
-        if (!mpInitialReservoir || mpInitialReservoir->getElementCount() != elementCount)
+        if (!mpInitialReservoir || mpInitialReservoir->getElementCount() < tileElementCount)
         {
-            mpInitialReservoir = Buffer::createStructured(mpReflectTypes["initialReservoirs"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+            mpInitialReservoir = Buffer::createStructured(mpReflectTypes["initialReservoirs"], tileElementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
         }
 
-        if (!mpFinalSample || mpFinalSample->getElementCount() != elementCount)
+        if (!mpFinalSample || mpFinalSample->getElementCount() < tileElementCount)
         {
-            mpFinalSample = Buffer::createStructured(mpReflectTypes["finalSample"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+            mpFinalSample = Buffer::createStructured(mpReflectTypes["finalSample"], tileElementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
         }
 
-        if (!mpAppendBuffer || mpAppendBuffer->getElementCount() != elementCount)
+        if (!mpAppendBuffer || mpAppendBuffer->getElementCount() < elementCount)
         {
             mpAppendBuffer = Buffer::createStructured(mpReflectTypes["appendBuffer"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
         }
@@ -118,12 +181,25 @@ namespace Falcor
 
         for (uint32_t i = 0; i < 2; i++)
         {
-            if (!mpReservoirs[i] || mpReservoirs[i]->getElementCount() != reservoirCount)
+            if (!mpReservoirs[i] || mpReservoirs[i]->getElementCount() < reservoirCount)
             {
                 mpReservoirs[i] = Buffer::createStructured(mpReflectTypes["spatiotemporalReservoirs"], reservoirCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+                /// the slot stride changed, old history can't be addressed anymore
+                pRenderContext->clearUAV(mpReservoirs[i]->getUAV().get(), uint4(0));
             }
         }
 
+        /// at most one occupied cell per pixel
+        if (!mpCellList || mpCellList->getElementCount() < elementCount)
+        {
+            mpCellList = Buffer::createStructured(mpReflectTypes["cellList"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+        }
+        if (!mpCellListCount)
+        {
+            mpCellListCount = Buffer::create(sizeof(uint32_t), Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+            mpCellListCount->setName("cellListCount");
+        }
+
         uint32_t hashBufferCount = 3200000 * sizeof(uint32_t);
         for (uint32_t i = 0; i < 2; i++)
         {
@@ -142,15 +218,37 @@ namespace Falcor
                 mpCheckSumBuffer[i] = Buffer::create(hashBufferCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
                 mpCheckSumBuffer[i]->setName("cellCounter");
             }
-            if (!mpCellStorage[i] || mpCellStorage[i]->getElementCount() != elementCount)
+            if (!mpCellStorage[i] || mpCellStorage[i]->getElementCount() < elementCount)
             {
                 mpCellStorage[i] = Buffer::createStructured(mpReflectTypes["cellStorage"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
             }
+            if (!mpCellReservoirs[i] || mpCellReservoirs[i]->getElementCount() < elementCount * kCellReservoirCount)
+            {
+                mpCellReservoirs[i] = Buffer::createStructured(mpReflectTypes["cellReservoirs"], elementCount * kCellReservoirCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+                pRenderContext->clearUAV(mpCellReservoirs[i]->getUAV().get(), uint4(0));
+            }
         }
     }
 
-    void WorldSpaceReSTIRGI::EndFrame(RenderContext* pRenderContext)
+    void WorldSpaceReSTIRGI::EndFrame(GIStageGraph& graph)
     {
+        uint current = (params.frameCount + 1) % 2;
+
+        /// the grid covers the whole frame, so it can only be built after every tile has been inserted.
+        /// it only waits on the insertions, the resampling and shading of this frame read the other grid
+        graph.addStage("BuildHashGrid",
+            { mpCellCounter[current].get(), mpAppendBuffer.get() },
+            { mpIndexBuffer[current].get(), mpCellStorage[current].get(), mpCellList.get(), mpCellListCount.get() },
+            [this, frameParams = params](RenderContext* pRenderContext) { BuildHashGridPass(pRenderContext, frameParams); });
+
+        if (mOptions->preMergedCellReservoirs)
+        {
+            graph.addStage("CellMerge",
+                { mpCellList.get(), mpCellListCount.get(), mpIndexBuffer[current].get(), mpCellCounter[current].get(), mpCellStorage[current].get(), mpReservoirs[current].get() },
+                { mpCellReservoirs[current].get() },
+                [this, frameParams = params](RenderContext* pRenderContext) { CellMergePass(pRenderContext, frameParams); });
+        }
+
         params.frameCount++;
 
         mPreCameraPos = mpScene->getCamera()->getPosition();
@@ -158,13 +256,31 @@ namespace Falcor
 
     }
 
-    void WorldSpaceReSTIRGI::UpdateReSTIRGI(RenderContext* pRenderContext, const Buffer::SharedPtr& initialSample, const Texture::SharedPtr& vNormW, const Texture::SharedPtr& vDepth, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer)
+    void WorldSpaceReSTIRGI::UpdateReSTIRGI(GIStageGraph& graph, const Buffer::SharedPtr& initialSample, const Texture::SharedPtr& vNormW, const Texture::SharedPtr& vDepth, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer)
     {
         UpdateProgram();
-        InitReservoirPass(pRenderContext, initialSample);
-        BuildHashGridPass(pRenderContext);
-        ResamplingPass(pRenderContext, vDepth, vNormW, reconnectionData,vbuffer);
-        FinalShadingPass(pRenderContext);
+
+        uint current = (params.frameCount + 1) % 2;
+        uint previous = (params.frameCount + 0) % 2;
+
+        graph.addStage("InitReservoir",
+            { initialSample.get() },
+            { mpInitialReservoir.get(), mpAppendBuffer.get(), mpCheckSumBuffer[current].get(), mpCellCounter[current].get() },
+            [this, frameParams = params, initialSample](RenderContext* pRenderContext) { InitReservoirPass(pRenderContext, frameParams, initialSample); });
+
+        graph.addStage("Resampling",
+            { vDepth.get(), vNormW.get(), reconnectionData.get(), vbuffer.get(), mpInitialReservoir.get(), mpReservoirs[previous].get(),
+              mpCellStorage[previous].get(), mpCellReservoirs[previous].get(), mpIndexBuffer[previous].get(), mpCheckSumBuffer[previous].get(), mpCellCounter[previous].get() },
+            { mpReservoirs[current].get() },
+            [this, frameParams = params, preCameraPos = mPreCameraPos, preViewProj = mPreViewProj, vDepth, vNormW, reconnectionData, vbuffer](RenderContext* pRenderContext)
+            {
+                ResamplingPass(pRenderContext, frameParams, preCameraPos, preViewProj, vDepth, vNormW, reconnectionData, vbuffer);
+            });
+
+        graph.addStage("FinalSample",
+            { mpReservoirs[current].get() },
+            { mpFinalSample.get() },
+            [this, frameParams = params](RenderContext* pRenderContext) { FinalShadingPass(pRenderContext, frameParams); });
     }
 
     void WorldSpaceReSTIRGI::UpdateProgram()
@@ -175,13 +291,23 @@ namespace Falcor
         ///only resampling pass need recompile
         mpInitReservoirPass = ComputePass::create(Program::Desc(kInitialReservoirFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
         mpBuildHashGridPass = ComputePass::create(Program::Desc(kBuildHashGridFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
+        mpCellMergePass = ComputePass::create(Program::Desc(kCellReservoirsFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
         mpGIResamplingPass = ComputePass::create(Program::Desc(kGIResamplingFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
         mpFinalShadingPass = ComputePass::create(Program::Desc(kFinalSampleFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
 
         mRecompile = false;
     }
 
-    void WorldSpaceReSTIRGI::InitReservoirPass(RenderContext* pRenderContext, const Buffer::SharedPtr& initialSample)
+    void WorldSpaceReSTIRGI::ClearHashGridPass(RenderContext* pRenderContext, const GIParameter& frameParams)
+    {
+        PROFILE("WorldSpaceReSTIR::ClearHashGrid");
+
+        pRenderContext->clearUAV(mpCheckSumBuffer[(frameParams.frameCount + 1) % 2]->getUAV().get(), uint4(0));
+        pRenderContext->clearUAV(mpCellCounter[(frameParams.frameCount + 1) % 2]->getUAV().get(), uint4(0));
+        pRenderContext->clearUAV(mpIndexBuffer[(frameParams.frameCount + 1) % 2]->getUAV().get(), uint4(0));
+    }
+
+    void WorldSpaceReSTIRGI::InitReservoirPass(RenderContext* pRenderContext, const GIParameter& frameParams, const Buffer::SharedPtr& initialSample)
     {
         PROFILE("WorldSpaceReSTIR::InitReservoir");
 
@@ -189,36 +315,59 @@ namespace Falcor
         var["sampleManager"]["initialSamples"] = initialSample;
         var["sampleManager"]["initialReservoirs"] = mpInitialReservoir;
         var["sampleManager"]["appendBuffer"] = mpAppendBuffer;
-        var["sampleManager"]["checkSum"] = mpCheckSumBuffer[(params.frameCount + 1) % 2];
-        var["sampleManager"]["cellCounters"] = mpCellCounter[(params.frameCount + 1) % 2];
+        var["sampleManager"]["checkSum"] = mpCheckSumBuffer[(frameParams.frameCount + 1) % 2];
+        var["sampleManager"]["cellCounters"] = mpCellCounter[(frameParams.frameCount + 1) % 2];
 
         var["sampleManager"]["cameraPos"] = mpScene->getCamera()->getPosition();
 
-        var["sampleManager"]["params"].setBlob(params);
+        var["sampleManager"]["params"].setBlob(frameParams);
 
-        var["sampleManager"]["finalSample"] = mpFinalSample;
-
-        mpInitReservoirPass->execute(pRenderContext, uint3(params.frameDim.x, params.frameDim.y, 1u));
+        mpInitReservoirPass->execute(pRenderContext, uint3(frameParams.tileDim.x, frameParams.tileDim.y, 1u));
     }
 
-    void WorldSpaceReSTIRGI::BuildHashGridPass(RenderContext* pRenderContext)
+    void WorldSpaceReSTIRGI::BuildHashGridPass(RenderContext* pRenderContext, const GIParameter& frameParams)
     {
         PROFILE("WorldSpaceReSTIR::BuildHashGrid");
 
-        pRenderContext->copyBufferRegion(mpIndexBuffer[(params.frameCount + 1) % 2].get(), 0, mpCellCounter[(params.frameCount + 1) % 2].get(), 0, mpCellCounter[(params.frameCount + 1) % 2]->getSize());
-        mpPrexfixSumPass->execute(pRenderContext, mpIndexBuffer[(params.frameCount + 1) % 2], static_cast<uint32_t>(mpIndexBuffer[(params.frameCount + 1) % 2]->getSize()));
+        pRenderContext->copyBufferRegion(mpIndexBuffer[(frameParams.frameCount + 1) % 2].get(), 0, mpCellCounter[(frameParams.frameCount + 1) % 2].get(), 0, mpCellCounter[(frameParams.frameCount + 1) % 2]->getSize());
+        mpPrexfixSumPass->execute(pRenderContext, mpIndexBuffer[(frameParams.frameCount + 1) % 2], static_cast<uint32_t>(mpIndexBuffer[(frameParams.frameCount + 1) % 2]->getSize()));
 
         auto var = mpBuildHashGridPass->getRootVar();
-        var["gridBuilder"]["indexBuffer"] = mpIndexBuffer[(params.frameCount + 1) % 2];
+        var["gridBuilder"]["indexBuffer"] = mpIndexBuffer[(frameParams.frameCount + 1) % 2];
         var["gridBuilder"]["appendBuffer"] = mpAppendBuffer;
-        var["gridBuilder"]["cellStorage"] = mpCellStorage[(params.frameCount + 1) % 2];
+        var["gridBuilder"]["cellStorage"] = mpCellStorage[(frameParams.frameCount + 1) % 2];
+
+        pRenderContext->clearUAV(mpCellListCount->getUAV().get(), uint4(0));
+        var["gridBuilder"]["cellList"] = mpCellList;
+        var["gridBuilder"]["cellListCount"] = mpCellListCount;
 
-        var["gridBuilder"]["params"].setBlob(params);
+        var["gridBuilder"]["params"].setBlob(frameParams);
 
-        mpBuildHashGridPass->execute(pRenderContext, uint3(params.frameDim.x, params.frameDim.y, 1u));
+        mpBuildHashGridPass->execute(pRenderContext, uint3(frameParams.frameDim.x, frameParams.frameDim.y, 1u));
     }
 
-    void WorldSpaceReSTIRGI::ResamplingPass(RenderContext* pRenderContext, const Texture::SharedPtr& vDepth, const Texture::SharedPtr& vNormW, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer)
+    void WorldSpaceReSTIRGI::CellMergePass(RenderContext* pRenderContext, const GIParameter& frameParams)
+    {
+        PROFILE("WorldSpaceReSTIR::CellMerge");
+
+        /// merges the reservoirs written this frame, they are read through the grid as preReservoirs next frame
+        auto var = mpCellMergePass->getRootVar();
+        var["cellMerger"]["cellList"] = mpCellList;
+        var["cellMerger"]["cellListCount"] = mpCellListCount;
+        var["cellMerger"]["indexBuffer"] = mpIndexBuffer[(frameParams.frameCount + 1) % 2];
+        var["cellMerger"]["cellCounters"] = mpCellCounter[(frameParams.frameCount + 1) % 2];
+        var["cellMerger"]["cellStorage"] = mpCellStorage[(frameParams.frameCount + 1) % 2];
+        var["cellMerger"]["reservoirs"] = mpReservoirs[(frameParams.frameCount + 1) % 2];
+        var["cellMerger"]["cellReservoirs"] = mpCellReservoirs[(frameParams.frameCount + 1) % 2];
+
+        var["cellMerger"]["spatialMaxM"] = mAccumulating ? mOptions->accumulatingMaxM : mOptions->spatialMaxM;
+        var["cellMerger"]["params"].setBlob(frameParams);
+
+        /// one workgroup per occupied cell, a fixed set of groups walks the list built by BuildHashGrid
+        mpCellMergePass->execute(pRenderContext, uint3(kCellMergeGroupCount * kCellMergeGroupSize, 1u, 1u));
+    }
+
+    void WorldSpaceReSTIRGI::ResamplingPass(RenderContext* pRenderContext, const GIParameter& frameParams, const float3& preCameraPos, const glm::float4x4& preViewProj, const Texture::SharedPtr& vDepth, const Texture::SharedPtr& vNormW, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer)
     {
         PROFILE("WorldSpaceReSTIR::ReSampling");
 
@@ -230,43 +379,76 @@ namespace Falcor
         var["resampleManager"]["norm"] = vNormW;
         var["resampleManager"]["reconnectionDataBuffer"] = reconnectionData;
 
-        var["resampleManager"]["prevViewProj"] = mPreViewProj;
-        var["resampleManager"]["cameraPrePos"] = mPreCameraPos;
+        var["resampleManager"]["prevViewProj"] = preViewProj;
+        var["resampleManager"]["cameraPrePos"] = preCameraPos;
 
         var["resampleManager"]["vbuffer"] = vbuffer;
 
         var["resampleManager"]["initialReservoirs"] = mpInitialReservoir;
-        var["resampleManager"]["preReservoirs"] = mpReservoirs[(params.frameCount + 0) % 2];
-        var["resampleManager"]["currentReservoirs"] = mpReservoirs[(params.frameCount + 1) % 2];
+        var["resampleManager"]["preReservoirs"] = mpReservoirs[(frameParams.frameCount + 0) % 2];
+        var["resampleManager"]["currentReservoirs"] = mpReservoirs[(frameParams.frameCount + 1) % 2];
 
-        var["resampleManager"]["cellStorage"] = mpCellStorage[(params.frameCount + 0) % 2];
-        var["resampleManager"]["indexBuffer"] = mpIndexBuffer[(params.frameCount + 0) % 2];
-        var["resampleManager"]["checkSum"] = mpCheckSumBuffer[(params.frameCount + 0) % 2];
-        var["resampleManager"]["cellCounters"] = mpCellCounter[(params.frameCount + 0) % 2];
+        var["resampleManager"]["cellStorage"] = mpCellStorage[(frameParams.frameCount + 0) % 2];
+        var["resampleManager"]["cellReservoirs"] = mpCellReservoirs[(frameParams.frameCount + 0) % 2];
+        var["resampleManager"]["indexBuffer"] = mpIndexBuffer[(frameParams.frameCount + 0) % 2];
+        var["resampleManager"]["checkSum"] = mpCheckSumBuffer[(frameParams.frameCount + 0) % 2];
+        var["resampleManager"]["cellCounters"] = mpCellCounter[(frameParams.frameCount + 0) % 2];
 
         var["resampleManager"]["numInstance"] = giInstanceNum;
-        var["resampleManager"]["params"].setBlob(params);
+        var["resampleManager"]["params"].setBlob(frameParams);
 
         var["resampleManager"]["depthThreshold"] = mOptions->depthThreshold;
         var["resampleManager"]["normalThreshold"] = mOptions->normalThreshold;
 
-        mpGIResamplingPass->execute(pRenderContext, uint3(params.frameDim.x, params.frameDim.y, 1u));
-
-        mPreCameraPos = mpScene->getCamera()->getPosition();
-        mPreViewProj = mpScene->getCamera()->getViewProjMatrixNoJitter();
+        var["resampleManager"]["temporalMaxM"] = mAccumulating ? mOptions->accumulatingMaxM : mOptions->temporalMaxM;
+        var["resampleManager"]["spatialMaxM"] = mAccumulating ? mOptions->accumulatingMaxM : mOptions->spatialMaxM;
+        var["resampleManager"]["maxAge"] = mAccumulating ? mOptions->accumulatingMaxM : mOptions->maxReservoirAge;
 
+        mpGIResamplingPass->execute(pRenderContext, uint3(frameParams.tileDim.x, frameParams.tileDim.y, 1u));
     }
 
-    void WorldSpaceReSTIRGI::FinalShadingPass(RenderContext* pRenderContext)
+    void WorldSpaceReSTIRGI::FinalShadingPass(RenderContext* pRenderContext, const GIParameter& frameParams)
     {
         PROFILE("WorldSpaceReSTIR::FinalSample");
         auto var = mpFinalShadingPass->getRootVar();
 
         var["finalSampleGenerator"]["finalSample"] = mpFinalSample;
-        var["finalSampleGenerator"]["currentReservoirs"] = mpReservoirs[(params.frameCount + 1) % 2];
-        var["finalSampleGenerator"]["params"].setBlob(params);
+        var["finalSampleGenerator"]["currentReservoirs"] = mpReservoirs[(frameParams.frameCount + 1) % 2];
+        var["finalSampleGenerator"]["params"].setBlob(frameParams);
+
+        mpFinalShadingPass->execute(pRenderContext, uint3(frameParams.tileDim.x, frameParams.tileDim.y, 1u));
+    }
+
+    void WorldSpaceReSTIRGI::CaptureHashInsertion(RenderContext* pRenderContext)
+    {
+        if (!mCaptureHashInsertion || !mpAppendBuffer) return;
+        mCaptureHashInsertion = false;
+
+        /// params still describe the frame that was just executed, EndFrame only advanced frameCount
+        HashInsertionSimulator::Frame frame;
+        frame.frameDim = params.frameDim;
+        frame.tileDim = GetTileDim(params.frameDim);
+        frame.data.resize(frame.frameDim.x * frame.frameDim.y);
+
+        size_t size = frame.data.size() * sizeof(HashInsertionSimulator::AppendData);
+        Buffer::SharedPtr pStaging = Buffer::create(size, Resource::BindFlags::None, Buffer::CpuAccess::Read);
+        pRenderContext->copyBufferRegion(pStaging.get(), 0, mpAppendBuffer.get(), 0, size);
+        pRenderContext->flush(true);
+        std::memcpy(frame.data.data(), pStaging->map(Buffer::MapType::Read), size);
+        pStaging->unmap();
+
+        std::string path = "hashAppendData" + std::to_string(params.instanceID) + ".bin";
+        if (!HashInsertionSimulator::save(path, frame))
+        {
+            logWarning("WorldSpaceReSTIRGI: failed to write '" + path + "'");
+            return;
+        }
 
-        mpFinalShadingPass->execute(pRenderContext, uint3(params.frameDim.x, params.frameDim.y, 1u));
+        HashInsertionSimulator::Stats stats = HashInsertionSimulator::simulate(frame);
+        logInfo("WorldSpaceReSTIRGI: saved '" + path + "', " + std::to_string(stats.validLanes) + " lanes in " + std::to_string(stats.waves) + " waves. per lane: "
+            + std::to_string(stats.perLaneProbes) + " probes, " + std::to_string(stats.perLaneAdds) + " adds. cooperative: "
+            + std::to_string(stats.cooperativeProbes) + " probes, " + std::to_string(stats.cooperativeAdds) + " adds, at most "
+            + std::to_string(stats.maxCellsPerWave) + " cells per wave");
     }
 
     void WorldSpaceReSTIRGI::CopyRecompileState(SharedPtr other)
@@ -6,6 +6,8 @@
 #include "Utils/Sampling/SampleGenerator.h"
 #include "Utils/Algorithm/PrefixSum.h"
 #include "Params.slang"
+#include "GIStageGraph.h"
+#include "HashInsertionSimulator.h"
 
 
 namespace Falcor
@@ -38,12 +40,35 @@ namespace Falcor
             float normalThreshold = 0.9f;
             float depthThreshold = 0.1f;
 
+            float minCellSize = 0.05f;          /// cell size of the finest clipmap level in world units
+            uint clipmapLevels = 12u;           /// each level doubles the cell size of the previous one
+            uint clipmapResolution = 64u;       /// cells per axis each level covers around the camera
+
+            uint temporalMaxM = 30u;            /// history length kept by the temporal reservoir
+            uint spatialMaxM = 100u;            /// history length kept by the spatial and cell reservoirs
+            uint maxReservoirAge = 100u;        /// reservoirs older than this frames drop their history
+            uint accumulatingMaxM = 100000u;    /// replaces the three caps above while the view is accumulated progressively
+
             /// <summary>
             /// static params -> changed requires recomplie
             /// </summary>
             float roughnessThreshold = 0.2f;
-            uint sceneGridDimension = 80u;
             TargetPdf resamplingTargetPdf = TargetPdf::IncomingRadiance;
+            bool waveCooperativeInsertion = true;     /// lanes of a wave sharing a cell insert it with one probe and one atomic add
+            bool preMergedCellReservoirs = true;      /// merge every cell into kCellReservoirCount reservoirs so spatial reuse is one fetch per cell
+
+            /// <summary>
+            /// resource params -> buffers are only ever grown, never reallocated on a smaller frame
+            /// </summary>
+            /// process the frame in tileSize x tileSize tiles, 0 disables tiling. this only bounds the per-pixel path
+            /// working set (initial samples, reconnection data, traced color, initial reservoirs, final samples,
+            /// ~230 B per pixel).
+            /// reservoir history (4 x 72 B), the append buffer (16 B) and the grid storage (cell indices, cell list and
+            /// cell reservoirs, 60 B) stay frame sized, temporal reprojection and the grid read any pixel of the frame.
+            /// peak memory is therefore not bounded by the tile, ~364 B per pixel grow with the frame whatever the tile
+            /// size (over 10 GB at 8K), so tiling does not make large resolutions fit.
+            uint tileSize = 0u;
+            uint2 maxFrameDim = uint2(0u);      /// allocate for this render size up front so dynamic resolution never reallocates
         };
 
         static SharedPtr create(const Scene::SharedPtr& pScene, const Options::SharedPtr& options, uint instanceID, uint numInstance);
@@ -52,24 +77,39 @@ namespace Falcor
 
         bool renderUI(Gui::Widgets& widget);
 
-        void BeginFrame(RenderContext* pRenderContext, uint2 frameDim);
-        void UpdateReSTIRGI(RenderContext* pRenderContext, const Buffer::SharedPtr& initialSample, const Texture::SharedPtr& vNormW, const Texture::SharedPtr& vDepth, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer);
-        void EndFrame(RenderContext* pRenderContext);
+        /// <summary>
+        /// the frame is recorded into graph as stages, they capture params by value so SetTile and EndFrame
+        /// can move on before the graph is executed
+        /// </summary>
+        void BeginFrame(RenderContext* pRenderContext, GIStageGraph& graph, uint2 frameDim);
+        void SetTile(uint2 tileOffset, uint2 tileDim);
+        uint2 GetTileDim(uint2 frameDim) const;
+        void UpdateReSTIRGI(GIStageGraph& graph, const Buffer::SharedPtr& initialSample, const Texture::SharedPtr& vNormW, const Texture::SharedPtr& vDepth, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer);
+        void EndFrame(GIStageGraph& graph);
 
         void CopyRecompileState(SharedPtr other);
 
-        Buffer::SharedPtr mpFinalSample;
+        /// set while the view is static and accumulated, relaxes the M caps so the reservoirs keep converging
+        void SetAccumulating(bool accumulating) { mAccumulating = accumulating; }
+
+        /// call once the frame's graph has run, saves the append buffer for HashInsertionSimulator if a capture was requested in the UI
+        void CaptureHashInsertion(RenderContext* pRenderContext);
+
+        const Buffer::SharedPtr& GetFinalSample() const { return mpFinalSample; }
+
         GIParameter params;
 
     private:
         WorldSpaceReSTIRGI(const Scene::SharedPtr& pScene, const Options::SharedPtr& options, uint instanceID, uint numInstance);
 
-        void UpdateResources(uint2 frameDim);
+        void UpdateResources(RenderContext* pRenderContext, uint2 frameDim, uint2 tileDim);
         void UpdateProgram();
-        void InitReservoirPass(RenderContext* pRenderContext, const Buffer::SharedPtr& initialSample);
-        void BuildHashGridPass(RenderContext* pRenderContext);
-        void ResamplingPass(RenderContext* pRenderContext, const Texture::SharedPtr& vDepth, const Texture::SharedPtr& vNormW, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer);
-        void FinalShadingPass(RenderContext* pRenderContext);
+        void ClearHashGridPass(RenderContext* pRenderContext, const GIParameter& frameParams);
+        void InitReservoirPass(RenderContext* pRenderContext, const GIParameter& frameParams, const Buffer::SharedPtr& initialSample);
+        void BuildHashGridPass(RenderContext* pRenderContext, const GIParameter& frameParams);
+        void CellMergePass(RenderContext* pRenderContext, const GIParameter& frameParams);
+        void ResamplingPass(RenderContext* pRenderContext, const GIParameter& frameParams, const float3& preCameraPos, const glm::float4x4& preViewProj, const Texture::SharedPtr& vDepth, const Texture::SharedPtr& vNormW, const Buffer::SharedPtr& reconnectionData, const Texture::SharedPtr& vbuffer);
+        void FinalShadingPass(RenderContext* pRenderContext, const GIParameter& frameParams);
 
         Options::SharedPtr mOptions;
         Scene::SharedPtr mpScene;
@@ -81,18 +121,26 @@ namespace Falcor
         ComputePass::SharedPtr mpGIResamplingPass;
         ComputePass::SharedPtr mpFinalShadingPass;
         ComputePass::SharedPtr mpBuildHashGridPass;
+        ComputePass::SharedPtr mpCellMergePass;
 
         ComputePass::SharedPtr mpReflectTypes;
 
-        Buffer::SharedPtr mpInitialReservoir;
-        Buffer::SharedPtr mpReservoirs[2];             /// store for both temporal and spatial reservoir
+        uint64_t GetTileSizedMemory() const;
+        uint64_t GetFrameSizedMemory() const;
+
+        Buffer::SharedPtr mpInitialReservoir;          /// tile sized
+        Buffer::SharedPtr mpFinalSample;               /// tile sized
+        Buffer::SharedPtr mpReservoirs[2];             /// store for both temporal and spatial reservoir, frame sized to keep history of every tile
 
-        Buffer::SharedPtr mpAppendBuffer;
+        Buffer::SharedPtr mpAppendBuffer;              /// frame sized, the hash grid is built once all tiles are processed
 
         Buffer::SharedPtr mpCellStorage[2];
         Buffer::SharedPtr mpIndexBuffer[2];
         Buffer::SharedPtr mpCheckSumBuffer[2];
         Buffer::SharedPtr mpCellCounter[2];
+        Buffer::SharedPtr mpCellReservoirs[2];
+        Buffer::SharedPtr mpCellList;                  /// occupied cells of the grid built this frame, consumed by the cell merge
+        Buffer::SharedPtr mpCellListCount;
 
         PrefixSum::SharedPtr mpPrexfixSumPass;
 
@@ -101,6 +149,8 @@ namespace Falcor
 
         bool mRecompile = true;
         bool mOptionChanged = false;
+        bool mAccumulating = false;
+        bool mCaptureHashInsertion = false;
 
         uint giInstanceNum = 1u;
     };
@@ -26,6 +26,8 @@
  # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  **************************************************************************/
 #include "WorldSpaceReSTIRGIPass.h"
+#include <filesystem>
+#include <fstream>
 
 
 namespace
@@ -36,6 +38,7 @@ namespace
     const std::string& kTracePassFilePath = "RenderPasses/WorldSpaceReSTIRGIPass/TracePass.rt.slang";
     const std::string& kFinalShadingFilePath = "RenderPasses/WorldSpaceReSTIRGIPass/FinalShading.cs.slang";
     const std::string& kReflectTypeFilePath = "RenderPasses/WorldSpaceReSTIRGIPass/ReflectTypes.cs.slang";
+    const std::string& kAccumulateFilePath = "RenderPasses/WorldSpaceReSTIRGIPass/Accumulate.cs.slang";
 
     const std::string& kInputVBuffer = "vbuffer";
     const std::string& kInputDepthBuffer = "vDepth";
@@ -43,6 +46,12 @@ namespace
 
     const std::string& kOutputColor = "outputColor";
 
+    const std::string& kMaxFrameDim = "maxFrameDim";
+    const std::string& kProgressive = "progressive";
+    const std::string& kOutputPath = "outputPath";
+    const std::string& kFlushInterval = "flushInterval";
+    const std::string& kChunkRows = "chunkRows";
+
     ChannelList InputChannel
     {
         {kInputVBuffer,"vbuffer","",false,ResourceFormat::Unknown},
@@ -56,6 +65,100 @@ namespace
     };
 
     const uint32_t kMaxPayloadSizeBytes = 256u;
+
+    /// <summary>
+    /// every flush writes a new generation of chunk files, each holding a band of rows of the running sum followed by
+    /// the same rows of its compensation. the manifest names the committed generation and is renamed into place last,
+    /// so an interrupted flush leaves the previous generation and its manifest untouched. next to every chunk the
+    /// mean of its rows is written as an .exr, the raw chunks are only meant for resuming.
+    /// </summary>
+    const uint32_t kAccumChunkMagic = 0x41494753u;     /// "SGIA"
+    const uint32_t kAccumManifestMagic = 0x4d494753u;  /// "SGIM"
+    const uint32_t kAccumChunkVersion = 2u;
+
+    struct AccumManifest
+    {
+        uint32_t magic = kAccumManifestMagic;
+        uint32_t version = kAccumChunkVersion;
+        uint32_t generation = 0u;
+        uint32_t chunkCount = 0u;
+        uint32_t chunkRows = 0u;
+        uint32_t accumulatedFrames = 0u;
+        uint2 frameDim = uint2(0u);
+        glm::float4x4 viewProj;
+    };
+
+    struct AccumChunkHeader
+    {
+        uint32_t magic = kAccumChunkMagic;
+        uint32_t version = kAccumChunkVersion;
+        uint2 frameDim = uint2(0u);
+        uint32_t generation = 0u;
+        uint32_t rowOffset = 0u;
+        uint32_t rowCount = 0u;
+        uint32_t pad = 0u;
+    };
+
+    std::string GetManifestPath(const std::string& outputPath)
+    {
+        return outputPath + ".manifest";
+    }
+
+    std::string GetChunkPath(const std::string& outputPath, uint32_t generation, uint32_t chunk)
+    {
+        return outputPath + ".g" + std::to_string(generation) + ".chunk" + std::to_string(chunk);
+    }
+
+    /// the resolved mean of the same rows, for viewing only, a resume always reads the raw chunk
+    std::string GetImageChunkPath(const std::string& outputPath, uint32_t generation, uint32_t chunk)
+    {
+        return GetChunkPath(outputPath, generation, chunk) + ".exr";
+    }
+
+    bool ReadAccumManifest(const std::string& outputPath, AccumManifest& manifest)
+    {
+        std::ifstream file(GetManifestPath(outputPath), std::ios::binary);
+        if (!file.read(reinterpret_cast<char*>(&manifest), sizeof(manifest))) return false;
+        return manifest.magic == kAccumManifestMagic && manifest.version == kAccumChunkVersion;
+    }
+
+    /// the rename of the manifest is the commit, until then a resume still reads the committed generation.
+    /// its chunks are only deleted once the rename went through
+    bool CommitAccumManifest(const std::string& outputPath, const AccumManifest& manifest)
+    {
+        AccumManifest committed;
+        bool hasCommitted = ReadAccumManifest(outputPath, committed);
+
+        std::string manifestPath = GetManifestPath(outputPath);
+        {
+            std::ofstream file(manifestPath + ".tmp", std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&manifest), sizeof(manifest));
+            file.close();
+            if (!file.good())
+            {
+                logWarning("WorldSpaceReSTIRGIPass: failed to write accumulation manifest '" + manifestPath + "'");
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(manifestPath + ".tmp", manifestPath, ec);
+        if (ec)
+        {
+            logWarning("WorldSpaceReSTIRGIPass: failed to replace accumulation manifest '" + manifestPath + "': " + ec.message());
+            return false;
+        }
+
+        if (hasCommitted && committed.generation != manifest.generation)
+        {
+            for (uint32_t chunk = 0; chunk < committed.chunkCount; chunk++)
+            {
+                std::filesystem::remove(GetChunkPath(outputPath, committed.generation, chunk), ec);
+                std::filesystem::remove(GetImageChunkPath(outputPath, committed.generation, chunk), ec);
+            }
+        }
+        return true;
+    }
 }
 
 // Don't remove this. it's required for hot-reload to function properly
@@ -71,20 +174,37 @@ extern "C" __declspec(dllexport) void getPasses(Falcor::RenderPassLibrary& lib)
 
 WorldSpaceReSTIRGIPass::SharedPtr WorldSpaceReSTIRGIPass::create(RenderContext* pRenderContext, const Dictionary& dict)
 {
-    SharedPtr pPass = SharedPtr(new WorldSpaceReSTIRGIPass);
+    SharedPtr pPass = SharedPtr(new WorldSpaceReSTIRGIPass(dict));
     return pPass;
 }
 
-WorldSpaceReSTIRGIPass::WorldSpaceReSTIRGIPass()
+WorldSpaceReSTIRGIPass::WorldSpaceReSTIRGIPass(const Dictionary& dict)
 {
     mOptions = WorldSpaceReSTIRGI::Options::create();
+    mpStageGraph = GIStageGraph::create();
+
+    for (const auto& [key, value] : dict)
+    {
+        if (key == kMaxFrameDim) mOptions->maxFrameDim = value;
+        else if (key == kProgressive) mAccumOptions.progressive = value;
+        else if (key == kOutputPath) mAccumOptions.outputPath = static_cast<std::string>(value);
+        else if (key == kFlushInterval) mAccumOptions.flushInterval = value;
+        else if (key == kChunkRows) mAccumOptions.chunkRows = value;
+        else logWarning("Unknown field '" + key + "' in WorldSpaceReSTIRGIPass dictionary");
+    }
 }
 
 std::string WorldSpaceReSTIRGIPass::getDesc() { return kDesc; }
 
 Dictionary WorldSpaceReSTIRGIPass::getScriptingDictionary()
 {
-    return Dictionary();
+    Dictionary dict;
+    dict[kMaxFrameDim] = mOptions->maxFrameDim;
+    dict[kProgressive] = mAccumOptions.progressive;
+    dict[kOutputPath] = mAccumOptions.outputPath;
+    dict[kFlushInterval] = mAccumOptions.flushInterval;
+    dict[kChunkRows] = mAccumOptions.chunkRows;
+    return dict;
 }
 
 RenderPassReflection WorldSpaceReSTIRGIPass::reflect(const CompileData& compileData)
@@ -126,20 +246,55 @@ void WorldSpaceReSTIRGIPass::execute(RenderContext* pRenderContext, const Render
         mOptionChanged = false;
     }
 
+    /// under dynamic resolution the output shrinks and grows, buffers stay allocated for the largest size
     params.frameDim = uint2(pOutputColor->getWidth(), pOutputColor->getHeight());
+    uint2 allocDim = glm::max(params.frameDim, mOptions->maxFrameDim);
+
+    /// may recreate the instances, so it has to happen before any of them records a stage
+    UpdateProgram();
+    UpdateAccumulation(renderData);
+
+    /// the frame is only recorded here, the graph orders it by the declared hazards once every instance is in
+    mpStageGraph->clear();
 
     for (uint32_t i = 0; i < reSTIRInstances.size(); i++)
     {
         params.currentGIInstance = i;
-        UpdateResource();
-        UpdateProgram();
+        UpdateResource(reSTIRInstances[i]->GetTileDim(allocDim));
+        /// the first frame after a reset still uses the regular caps, history from before the change is stale.
+        /// a resume only restores the mean, the reservoirs start over, so this counts the frames of this session
+        reSTIRInstances[i]->SetAccumulating(mAccumOptions.progressive && mSessionFrames > 0);
         //std::cout << "heer";
-        reSTIRInstances[i]->BeginFrame(pRenderContext, params.frameDim);
-        PrepareGIData(pRenderContext, renderData);
-        //reSTIRInstances[i]->params._pad = float3(pad, 0, 0);
-        reSTIRInstances[i]->UpdateReSTIRGI(pRenderContext, mpInitialSample,renderData[kInputNormBuffer]->asTexture(), renderData[kInputDepthBuffer]->asTexture(), mpReconnectionData,renderData[kInputVBuffer]->asTexture());
-        FinalShading(pRenderContext, renderData, i);
-        reSTIRInstances[i]->EndFrame(pRenderContext);
+        reSTIRInstances[i]->BeginFrame(pRenderContext, *mpStageGraph, params.frameDim);
+        uint2 tileDim = reSTIRInstances[i]->GetTileDim(params.frameDim);
+
+        /// tiles are visited in the same scanline order every frame, reservoir history stays in frame sized buffers
+        for (uint y = 0; y < params.frameDim.y; y += tileDim.y)
+        {
+            for (uint x = 0; x < params.frameDim.x; x += tileDim.x)
+            {
+                params.tileOffset = uint2(x, y);
+                params.tileDim = glm::min(tileDim, params.frameDim - params.tileOffset);
+                reSTIRInstances[i]->SetTile(params.tileOffset, params.tileDim);
+
+                PrepareGIData(*mpStageGraph, renderData);
+                //reSTIRInstances[i]->params._pad = float3(pad, 0, 0);
+                reSTIRInstances[i]->UpdateReSTIRGI(*mpStageGraph, mpInitialSample, renderData[kInputNormBuffer]->asTexture(), renderData[kInputDepthBuffer]->asTexture(), mpReconnectionData, renderData[kInputVBuffer]->asTexture());
+                FinalShading(*mpStageGraph, renderData, i);
+            }
+        }
+
+        reSTIRInstances[i]->EndFrame(*mpStageGraph);
+    }
+
+    Accumulate(*mpStageGraph, renderData);
+
+    mpStageGraph->execute(pRenderContext);
+    for (auto& pInstance : reSTIRInstances) pInstance->CaptureHashInsertion(pRenderContext);
+
+    if (mAccumOptions.progressive && !mAccumOptions.outputPath.empty() && mAccumFrames % std::max(mAccumOptions.flushInterval, 1u) == 0)
+    {
+        StreamAccumulation(pRenderContext);
     }
 
     params.frameCount++;
@@ -173,6 +328,16 @@ void WorldSpaceReSTIRGIPass::renderUI(Gui::Widgets& widget)
 
     runtimeDirty |= widget.var("11", pad, 0u, 2u);
 
+    /// none of these change the image, the accumulation resets by itself when progressive is toggled
+    if (widget.group("progressive accumulation"))
+    {
+        widget.checkbox("progressive", mAccumOptions.progressive);
+        widget.textbox("output path", mAccumOptions.outputPath);
+        widget.var("flush interval", mAccumOptions.flushInterval, 1u, 65536u);
+        widget.var("chunk rows", mAccumOptions.chunkRows, 1u, 4096u);
+        widget.text("accumulated frames: " + std::to_string(mAccumFrames));
+    }
+
     if (staticDirty) mRecompile = true;
     bool dirty = staticDirty || runtimeDirty;
     if (dirty) mOptionChanged = true;
@@ -182,6 +347,10 @@ void WorldSpaceReSTIRGIPass::setScene(RenderContext* pRenderContext, const Scene
 {
     mpScene = pScene;
     params.frameCount = 0u;
+    mAccumDim = uint2(0u);
+    mAccumFrames = 0u;
+    mSessionFrames = 0u;
+    mAccumResumePending = true;
 
     mPathTracingPass.mpProgram = nullptr;
     mPathTracingPass.mpBindTable = nullptr;
@@ -234,6 +403,7 @@ void WorldSpaceReSTIRGIPass::setScene(RenderContext* pRenderContext, const Scene
 
     mpReflectTypePass = ComputePass::create(Program::Desc(kReflectTypeFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
     mpFinalShadingPass = ComputePass::create(Program::Desc(kFinalShadingFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
+    mpAccumulatePass = ComputePass::create(Program::Desc(kAccumulateFilePath).setShaderModel(kShaderMode).csEntry("main"), defines);
 
     {
         reSTIRInstances.clear();
@@ -275,17 +445,21 @@ void WorldSpaceReSTIRGIPass::UpdateProgram()
     }
 }
 
-void WorldSpaceReSTIRGIPass::UpdateResource()
+void WorldSpaceReSTIRGIPass::UpdateResource(uint2 tileDim)
 {
-    uint32_t elementCount = params.frameDim.x * params.frameDim.y;
-    if (!mpInitialSample || mpInitialSample->getElementCount() != elementCount)
+    uint32_t elementCount = tileDim.x * tileDim.y;
+    if (!mpInitialSample || mpInitialSample->getElementCount() < elementCount)
     {
         mpInitialSample = Buffer::createStructured(mpReflectTypePass["initialSamples"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
     }
-    if (!mpReconnectionData || mpReconnectionData->getElementCount() != elementCount)
+    if (!mpReconnectionData || mpReconnectionData->getElementCount() < elementCount)
     {
         mpReconnectionData = Buffer::createStructured(mpReflectTypePass["reconnectionDataBuffer"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
     }
+    if (!mpTracedColor || mpTracedColor->getElementCount() < elementCount)
+    {
+        mpTracedColor = Buffer::createStructured(mpReflectTypePass["tracedColor"], elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+    }
 }
 
 Program::DefineList WorldSpaceReSTIRGIPass::GetDefines()
@@ -312,39 +486,255 @@ Program::DefineList WorldSpaceReSTIRGIPass::GetDefines()
     return defines;
 }
 
-void WorldSpaceReSTIRGIPass::PrepareGIData(RenderContext* pRenderContext, const RenderData& renderData)
+void WorldSpaceReSTIRGIPass::PrepareGIData(GIStageGraph& graph, const RenderData& renderData)
+{
+    Texture::SharedPtr pVBuffer = renderData[kInputVBuffer]->asTexture();
+    Buffer::SharedPtr initialSample = mpInitialSample;
+    Buffer::SharedPtr reconnectionData = mpReconnectionData;
+    Buffer::SharedPtr tracedColor = mpTracedColor;
+
+    graph.addStage("TracePath",
+        { pVBuffer.get() },
+        { initialSample.get(), reconnectionData.get(), tracedColor.get() },
+        [this, frameParams = params, pVBuffer, initialSample, reconnectionData, tracedColor](RenderContext* pRenderContext)
+        {
+            auto vars = mPathTracingPass.mpVars->getRootVar();
+
+            vars["sampleInitializer"]["vbuffer"] = pVBuffer;
+            vars["sampleInitializer"]["initialSamples"] = initialSample;
+            vars["sampleInitializer"]["reconnectionDataBuffer"] = reconnectionData;
+            vars["sampleInitializer"]["tracedColor"] = tracedColor;
+            vars["sampleInitializer"]["roughnessThreshold"] = mOptions->roughnessThreshold;
+
+            vars["pathtracer"]["params"].setBlob(frameParams);
+            vars["gScene"] = mpScene->getParameterBlock();
+
+            if (mpEnvMapSampler) mpEnvMapSampler->setShaderData(vars["pathtracer"]["envMapSampler"]);
+            if (mpEmissiveSampler) mpEmissiveSampler->setShaderData(vars["pathtracer"]["emissiveSampler"]);
+
+            mpScene->raytrace(pRenderContext, mPathTracingPass.mpProgram.get(), mPathTracingPass.mpVars, uint3(frameParams.tileDim.x, frameParams.tileDim.y, 1u));
+        });
+}
+
+void WorldSpaceReSTIRGIPass::FinalShading(GIStageGraph& graph, const RenderData& renderData, uint currentInstance)
 {
-    auto vars = mPathTracingPass.mpVars->getRootVar();
+    Texture::SharedPtr pVBuffer = renderData[kInputVBuffer]->asTexture();
+    Texture::SharedPtr pOutputColor = renderData[kOutputColor]->asTexture();
+    Buffer::SharedPtr pFinalSample = reSTIRInstances[currentInstance]->GetFinalSample();
+    Buffer::SharedPtr reconnectionData = mpReconnectionData;
+    Buffer::SharedPtr tracedColor = mpTracedColor;
+
+    graph.addStage("FinalShading",
+        { pVBuffer.get(), reconnectionData.get(), tracedColor.get(), pFinalSample.get() },
+        { pOutputColor.get() },
+        [this, frameParams = params, pVBuffer, pOutputColor, pFinalSample, reconnectionData, tracedColor](RenderContext* pRenderContext)
+        {
+            auto vars = mpFinalShadingPass->getRootVar();
 
-    vars["sampleInitializer"]["vbuffer"] = renderData[kInputVBuffer]->asTexture();
-    vars["sampleInitializer"]["initialSamples"] = mpInitialSample;
-    vars["sampleInitializer"]["outputColor"] = renderData[kOutputColor]->asTexture();
-    vars["sampleInitializer"]["reconnectionDataBuffer"] = mpReconnectionData;
-    vars["sampleInitializer"]["roughnessThreshold"] = mOptions->roughnessThreshold;
+            vars["finalShading"]["vbuffer"] = pVBuffer;
+            vars["finalShading"]["reconnectionDataBuffer"] = reconnectionData;
+            vars["finalShading"]["tracedColor"] = tracedColor;
 
-    vars["pathtracer"]["params"].setBlob(params);
-    vars["gScene"] = mpScene->getParameterBlock();
+            vars["finalShading"]["outputColor"] = pOutputColor;
 
-    if (mpEnvMapSampler) mpEnvMapSampler->setShaderData(vars["pathtracer"]["envMapSampler"]);
-    if (mpEmissiveSampler) mpEmissiveSampler->setShaderData(vars["pathtracer"]["emissiveSampler"]);
+            vars["finalShading"]["params"].setBlob(frameParams);
+            vars["finalShading"]["finalSample"] = pFinalSample;
 
-    mpScene->raytrace(pRenderContext, mPathTracingPass.mpProgram.get(), mPathTracingPass.mpVars, uint3(params.frameDim.x, params.frameDim.y, 1u));
+            vars["gScene"] = mpScene->getParameterBlock();
+
+            mpFinalShadingPass->execute(pRenderContext, uint3(frameParams.tileDim.x, frameParams.tileDim.y, 1u));
+        });
 }
 
-void WorldSpaceReSTIRGIPass::FinalShading(RenderContext* pRenderContext, const RenderData& renderData, uint currentInstance)
+void WorldSpaceReSTIRGIPass::UpdateAccumulation(const RenderData& renderData)
 {
-    auto vars = mpFinalShadingPass->getRootVar();
+    /// scene edits and options of any pass in the graph change the image itself, unlike a resize or a new view
+    const Scene::UpdateFlags kViewUpdates = Scene::UpdateFlags::CameraMoved | Scene::UpdateFlags::CameraPropertiesChanged | Scene::UpdateFlags::CameraSwitched;
+    bool contentChanged = (mpScene->getUpdates() & ~kViewUpdates) != Scene::UpdateFlags::None;
+    contentChanged |= renderData.getDictionary().getValue(kRenderPassRefreshFlags, RenderPassRefreshFlags::None) != RenderPassRefreshFlags::None;
 
-    vars["finalShading"]["vbuffer"] = renderData[kInputVBuffer]->asTexture();
-    vars["finalShading"]["reconnectionDataBuffer"] = mpReconnectionData;
+    if (!mAccumOptions.progressive)
+    {
+        mAccumFrames = 0u;
+        mSessionFrames = 0u;
+        if (contentChanged) mAccumResumePending = false;
+        return;
+    }
 
-    vars["finalShading"]["outputColor"] = renderData[kOutputColor]->asTexture();
+    bool reset = false;
+    if (mAccumDim != params.frameDim)
+    {
+        uint32_t elementCount = params.frameDim.x * params.frameDim.y;
+        mpAccumSum = Buffer::createStructured(sizeof(float4), elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+        mpAccumCompensation = Buffer::createStructured(sizeof(float4), elementCount, Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+        mAccumDim = params.frameDim;
+        reset = true;
+    }
 
-    vars["finalShading"]["params"].setBlob(params);
-    vars["finalShading"]["finalSample"] = reSTIRInstances[currentInstance]->mpFinalSample;
+    /// anything that changes the image restarts the mean
+    glm::float4x4 viewProj = mpScene->getCamera()->getViewProjMatrixNoJitter();
+    reset |= viewProj != mAccumViewProj;
+    reset |= contentChanged;
+    mAccumViewProj = viewProj;
 
-    vars["gScene"] = mpScene->getParameterBlock();
+    if (!reset) return;
 
-    mpFinalShadingPass->execute(pRenderContext, uint3(params.frameDim.x, params.frameDim.y, 1u));
+    mAccumFrames = 0u;
+    mSessionFrames = 0u;
+    if (mAccumOptions.outputPath.empty()) return;
+
+    /// only the first progressive frame after loading picks up an interrupted run. later resets mean the settings
+    /// moved on, and a content change makes the flushed sum stale even if the view comes back to it
+    if (mAccumResumePending)
+    {
+        mAccumResumePending = false;
+        if (ResumeAccumulation())
+        {
+            logInfo("WorldSpaceReSTIRGIPass: resumed " + std::to_string(mAccumFrames) + " accumulated frames from '" + mAccumOptions.outputPath + "'");
+        }
+    }
+    else if (contentChanged)
+    {
+        InvalidateAccumulation();
+    }
 }
 
+void WorldSpaceReSTIRGIPass::Accumulate(GIStageGraph& graph, const RenderData& renderData)
+{
+    if (!mAccumOptions.progressive) return;
+
+    mAccumFrames++;
+    mSessionFrames++;
+    Texture::SharedPtr pOutputColor = renderData[kOutputColor]->asTexture();
+
+    graph.addStage("Accumulate",
+        { pOutputColor.get() },
+        { pOutputColor.get(), mpAccumSum.get(), mpAccumCompensation.get() },
+        [this, frameParams = params, accumulatedFrames = mAccumFrames, pOutputColor](RenderContext* pRenderContext)
+        {
+            PROFILE("WorldSpaceReSTIRGIPass::Accumulate");
+
+            auto vars = mpAccumulatePass->getRootVar();
+
+            vars["accumulator"]["outputColor"] = pOutputColor;
+            vars["accumulator"]["accumSum"] = mpAccumSum;
+            vars["accumulator"]["accumCompensation"] = mpAccumCompensation;
+            vars["accumulator"]["accumulatedFrames"] = accumulatedFrames;
+            vars["accumulator"]["params"].setBlob(frameParams);
+
+            mpAccumulatePass->execute(pRenderContext, uint3(frameParams.frameDim.x, frameParams.frameDim.y, 1u));
+        });
+}
+
+bool WorldSpaceReSTIRGIPass::ResumeAccumulation()
+{
+    AccumManifest manifest;
+    if (!ReadAccumManifest(mAccumOptions.outputPath, manifest)) return false;
+    if (manifest.frameDim != mAccumDim || manifest.viewProj != mAccumViewProj || manifest.accumulatedFrames == 0) return false;
+    if (manifest.chunkRows == 0 || manifest.chunkCount != (mAccumDim.y + manifest.chunkRows - 1) / manifest.chunkRows) return false;
+
+    uint64_t rowBytes = mAccumDim.x * sizeof(float4);
+    std::vector<char> data;
+
+    for (uint32_t chunk = 0; chunk < manifest.chunkCount; chunk++)
+    {
+        uint32_t row = chunk * manifest.chunkRows;
+        std::ifstream file(GetChunkPath(mAccumOptions.outputPath, manifest.generation, chunk), std::ios::binary);
+        AccumChunkHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+
+        if (header.magic != kAccumChunkMagic || header.version != kAccumChunkVersion || header.generation != manifest.generation) return false;
+        if (header.frameDim != mAccumDim || header.rowOffset != row || header.rowCount != std::min(manifest.chunkRows, mAccumDim.y - row)) return false;
+
+        uint64_t bytes = header.rowCount * rowBytes;
+        data.resize(2 * bytes);
+        if (!file.read(data.data(), data.size())) return false;
+
+        mpAccumSum->setBlob(data.data(), row * rowBytes, bytes);
+        mpAccumCompensation->setBlob(data.data() + bytes, row * rowBytes, bytes);
+    }
+
+    mAccumFrames = manifest.accumulatedFrames;
+    return true;
+}
+
+void WorldSpaceReSTIRGIPass::StreamAccumulation(RenderContext* pRenderContext)
+{
+    PROFILE("WorldSpaceReSTIRGIPass::StreamAccumulation");
+
+    uint32_t chunkRows = std::max(mAccumOptions.chunkRows, 1u);
+    uint64_t rowBytes = mAccumDim.x * sizeof(float4);
+    uint64_t chunkBytes = chunkRows * rowBytes;
+
+    /// only one chunk is read back at a time, so the cpu side stays small whatever the resolution
+    if (!mpAccumStaging || mpAccumStaging->getSize() < 2 * chunkBytes)
+    {
+        mpAccumStaging = Buffer::create(2 * chunkBytes, Resource::BindFlags::None, Buffer::CpuAccess::Read);
+    }
+
+    /// the new generation never shares a file with the committed one. leftovers of an interrupted flush carry the
+    /// same number and are simply overwritten
+    AccumManifest committed;
+    bool hasCommitted = ReadAccumManifest(mAccumOptions.outputPath, committed);
+
+    AccumManifest manifest;
+    manifest.generation = hasCommitted ? committed.generation + 1 : 0u;
+    manifest.chunkRows = chunkRows;
+    manifest.accumulatedFrames = mAccumFrames;
+    manifest.frameDim = mAccumDim;
+    manifest.viewProj = mAccumViewProj;
+
+    AccumChunkHeader header;
+    header.frameDim = mAccumDim;
+    header.generation = manifest.generation;
+    std::vector<float4> mean;
+
+    for (uint32_t row = 0; row < mAccumDim.y; row += chunkRows, manifest.chunkCount++)
+    {
+        header.rowOffset = row;
+        header.rowCount = std::min(chunkRows, mAccumDim.y - row);
+        uint64_t bytes = header.rowCount * rowBytes;
+
+        pRenderContext->copyBufferRegion(mpAccumStaging.get(), 0, mpAccumSum.get(), row * rowBytes, bytes);
+        pRenderContext->copyBufferRegion(mpAccumStaging.get(), chunkBytes, mpAccumCompensation.get(), row * rowBytes, bytes);
+        pRenderContext->flush(true);
+
+        const char* pData = static_cast<const char*>(mpAccumStaging->map(Buffer::MapType::Read));
+        std::ofstream file(GetChunkPath(mAccumOptions.outputPath, manifest.generation, manifest.chunkCount), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(pData, bytes);
+        file.write(pData + chunkBytes, bytes);
+
+        /// the same band as it shows on screen, sum / frames like Accumulate.cs.slang
+        const float4* pSum = reinterpret_cast<const float4*>(pData);
+        mean.resize(header.rowCount * mAccumDim.x);
+        for (size_t i = 0; i < mean.size(); i++) mean[i] = float4(float3(pSum[i]) / float(mAccumFrames), 1.f);
+        mpAccumStaging->unmap();
+        file.close();
+
+        if (!file.good())
+        {
+            logWarning("WorldSpaceReSTIRGIPass: failed to write accumulation chunks to '" + mAccumOptions.outputPath + "'");
+            return;
+        }
+
+        Bitmap::saveImage(GetImageChunkPath(mAccumOptions.outputPath, manifest.generation, manifest.chunkCount), mAccumDim.x, header.rowCount,
+            Bitmap::FileFormat::ExrFile, Bitmap::ExportFlags::None, ResourceFormat::RGBA32Float, true, mean.data());
+    }
+
+    if (CommitAccumManifest(mAccumOptions.outputPath, manifest))
+    {
+        logInfo("WorldSpaceReSTIRGIPass: mean of " + std::to_string(mAccumFrames) + " frames written to '" + GetImageChunkPath(mAccumOptions.outputPath, manifest.generation, 0) + "' and the following chunks");
+    }
+}
+
+void WorldSpaceReSTIRGIPass::InvalidateAccumulation()
+{
+    /// an empty generation: nothing left on disk can be resumed, and the next flush still gets a fresh number
+    AccumManifest committed;
+    if (!ReadAccumManifest(mAccumOptions.outputPath, committed) || committed.chunkCount == 0) return;
+
+    AccumManifest manifest;
+    manifest.generation = committed.generation + 1;
+    CommitAccumManifest(mAccumOptions.outputPath, manifest);
+}
@@ -59,16 +59,23 @@ public:
     virtual bool onKeyEvent(const KeyboardEvent& keyEvent) override { return false; }
 
 private:
-    WorldSpaceReSTIRGIPass();
+    WorldSpaceReSTIRGIPass(const Dictionary& dict);
 
     void UpdateProgram();
-    void UpdateResource();
+    void UpdateResource(uint2 tileDim);
     Program::DefineList GetDefines();
 
-    void PrepareGIData(RenderContext* pRenderContext, const RenderData& renderData);
-    void FinalShading(RenderContext* pRenderContext, const RenderData& renderData, uint currentInstance);
+    void PrepareGIData(GIStageGraph& graph, const RenderData& renderData);
+    void FinalShading(GIStageGraph& graph, const RenderData& renderData, uint currentInstance);
+
+    void UpdateAccumulation(const RenderData& renderData);
+    void Accumulate(GIStageGraph& graph, const RenderData& renderData);
+    bool ResumeAccumulation();
+    void StreamAccumulation(RenderContext* pRenderContext);
+    void InvalidateAccumulation();
 
     ComputePass::SharedPtr mpFinalShadingPass;
+    ComputePass::SharedPtr mpAccumulatePass;
     ComputePass::SharedPtr mpReflectTypePass;
 
     struct RtPass
@@ -89,6 +96,17 @@ private:
         uint maxBounces = 3u;
     } mPtOptions;
 
+    /// <summary>
+    /// offline progressive mode, the output becomes the running mean of every frame since the view last changed
+    /// </summary>
+    struct AccumulationOptions
+    {
+        bool progressive = false;
+        std::string outputPath;             /// streamed to outputPath.manifest and the chunks it names: the raw sum for resuming plus the mean of every chunk as .exr, empty disables both
+        uint flushInterval = 256u;          /// frames between two writes of the chunks
+        uint chunkRows = 64u;               /// rows per chunk, bounds the readback memory
+    } mAccumOptions;
+
     bool mOptionChanged = false;
     bool mRecompile = false;
     bool mNeedRecreateReSTIRGIInstance = false;
@@ -98,8 +116,20 @@ private:
     WorldSpaceReSTIRGI::Options::SharedPtr mOptions;
     std::vector<WorldSpaceReSTIRGI::SharedPtr> reSTIRInstances;
 
-    Buffer::SharedPtr mpInitialSample;
-    Buffer::SharedPtr mpReconnectionData;
+    GIStageGraph::SharedPtr mpStageGraph;     /// every stage of a frame, recorded for all instances and tiles before it is executed
+
+    Buffer::SharedPtr mpInitialSample;        /// tile sized, reused by every tile and instance
+    Buffer::SharedPtr mpReconnectionData;     /// tile sized
+    Buffer::SharedPtr mpTracedColor;          /// tile sized, composed into the output by FinalShading
+
+    Buffer::SharedPtr mpAccumSum;             /// frame sized running sum
+    Buffer::SharedPtr mpAccumCompensation;    /// Kahan compensation of mpAccumSum
+    Buffer::SharedPtr mpAccumStaging;         /// readback of one chunk of both buffers
+    uint2 mAccumDim = uint2(0u);
+    uint mAccumFrames = 0u;
+    uint mSessionFrames = 0u;                 /// frames accumulated since the reservoirs were last reset, a resume starts at 0
+    bool mAccumResumePending = true;          /// set on load, the next progressive reset tries the flushed run first
+    glm::float4x4 mAccumViewProj;
 
     Scene::SharedPtr mpScene;
     SampleGenerator::SharedPtr mpSampleGenerator;
@@ -0,0 +1,227 @@
+#include "Testing/UnitTest.h"
+#include "Experimental/WorldSpaceReSTIRGI/ReservoirKernels.h"
+
+namespace Falcor
+{
+    namespace
+    {
+        using Kernels = ReservoirKernels;
+
+        /// unit emitter quad at z = 1 facing down, every member of the cell sits below it and sees all of it
+        const uint32_t kMemberCount = 8;
+        const size_t kTrials = 1 << 18;
+        const float kReceiver[3] = { 0.3f, -0.2f, 0.1f };
+
+        void memberPos(uint32_t j, float pos[3])
+        {
+            pos[0] = 1.5f * std::cos(float(j));
+            pos[1] = 1.5f * std::sin(2.f * j);
+            pos[2] = 0.9f * float(j) / kMemberCount - 0.5f;
+        }
+
+        float emitted(float u, float v) { return 1.f + 4.f * u * u + 2.f * v; }
+
+        /// cos / R^2 of the emitter point (u, v) seen from pos
+        double solidAngleDensity(const float pos[3], double u, double v)
+        {
+            double d[3] = { pos[0] - u, pos[1] - v, pos[2] - 1.0 };
+            double dist2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            return -d[2] / (dist2 * std::sqrt(dist2));
+        }
+
+        /// integral of the emitted radiance over the solid angle the quad covers at the receiver, midpoint rule
+        double referenceIntegral()
+        {
+            const uint32_t n = 1024;
+            double sum = 0.0;
+            for (uint32_t y = 0; y < n; y++)
+            {
+                for (uint32_t x = 0; x < n; x++)
+                {
+                    double u = (x + 0.5) / n - 0.5;
+                    double v = (y + 0.5) / n - 0.5;
+                    sum += emitted(float(u), float(v)) * solidAngleDensity(kReceiver, u, v);
+                }
+            }
+            return sum / (double(n) * n);
+        }
+
+        struct Estimate
+        {
+            double mean = 0.0;
+            double stdError = 0.0;
+        };
+
+        Estimate estimate(const Kernels::ReservoirBatch& batch, const std::vector<float>& targetPdf)
+        {
+            double sum = 0.0, sum2 = 0.0;
+            for (size_t i = 0; i < kTrials; i++)
+            {
+                double e = double(targetPdf[i]) * batch.weightF[i];
+                sum += e;
+                sum2 += e * e;
+            }
+
+            Estimate result;
+            result.mean = sum / kTrials;
+            result.stdError = std::sqrt(std::max(sum2 / kTrials - result.mean * result.mean, 0.0) / kTrials);
+            return result;
+        }
+
+        void seedBatch(Kernels::RngBatch& rng, uint32_t sampleNumber)
+        {
+            rng.resize(kTrials);
+            for (size_t i = 0; i < kTrials; i++) rng.seed(i, uint2(uint32_t(i & 0xffff), uint32_t(i >> 16)), sampleNumber);
+        }
+
+        /// one uniform draw on the emitter per lane, stored as a solid angle reservoir at pos
+        void drawEmitterSample(Kernels::RngBatch& rng, const float pos[3], uint32_t M, Kernels::ReservoirBatch& candidate)
+        {
+            for (size_t i = 0; i < kTrials; i++)
+            {
+                float u = rng.next1D(i) - 0.5f;
+                float v = rng.next1D(i) - 0.5f;
+                float L = emitted(u, v);
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                    candidate.vPos[c][i] = pos[c];
+                    candidate.radiance[c][i] = L;
+                }
+                candidate.sPos[0][i] = u;
+                candidate.sPos[1][i] = v;
+                candidate.sPos[2][i] = 1.f;
+                candidate.sNorm[0][i] = 0.f;
+                candidate.sNorm[1][i] = 0.f;
+                candidate.sNorm[2][i] = -1.f;
+                candidate.M[i] = M;
+                candidate.weightF[i] = float(solidAngleDensity(pos, u, v));     /// 1 / pdf in solid angle at pos
+            }
+        }
+
+        /// <summary>
+        /// every member draws one emitter point uniformly by area and stores a solid angle reservoir at its own vPos,
+        /// the members are merged into one cell reservoir and handed to the receiver in solid angle at kReceiver.
+        /// mScale scales the members' M, sampleNumber picks an independent set of draws
+        /// </summary>
+        void buildCell(bool areaMeasure, uint32_t mScale, uint32_t sampleNumber, Kernels::ReservoirBatch& cell)
+        {
+            Kernels::ReservoirBatch candidate;
+            Kernels::RngBatch rng;
+            cell.resize(kTrials);
+            candidate.resize(kTrials);
+            seedBatch(rng, sampleNumber);
+
+            std::vector<float> weightS(kTrials, 0.f);
+            std::vector<float> targetPdf;
+
+            for (uint32_t j = 0; j < kMemberCount; j++)
+            {
+                float pos[3];
+                memberPos(j, pos);
+                drawEmitterSample(rng, pos, mScale * (1 + j % 3), candidate);
+                for (size_t i = 0; i < kTrials; i++) candidate.age[i] = int32_t(j);      /// follows the selection through merge
+
+                if (areaMeasure) Kernels::toAreaMeasure(candidate);
+                Kernels::evalTargetPdf(candidate, targetPdf);
+                Kernels::merge(cell, weightS, candidate, targetPdf, rng);
+            }
+
+            Kernels::evalTargetPdf(cell, targetPdf);
+            Kernels::computeFinalWeight(cell, targetPdf, weightS);
+
+            for (size_t i = 0; i < kTrials; i++)
+            {
+                float selected[3];
+                memberPos(uint32_t(cell.age[i]), selected);
+                for (uint32_t c = 0; c < 3; c++) cell.vPos[c][i] = areaMeasure ? kReceiver[c] : selected[c];
+            }
+
+            if (areaMeasure)
+            {
+                Kernels::toSolidAngle(cell);
+            }
+            else
+            {
+                /// what the receiver did before: one neighbor jacobian from the selected member's vPos
+                for (size_t i = 0; i < kTrials; i++)
+                {
+                    float selected[3];
+                    memberPos(uint32_t(cell.age[i]), selected);
+                    double u = cell.sPos[0][i], v = cell.sPos[1][i];
+                    double jacobian = std::min(solidAngleDensity(kReceiver, u, v) / solidAngleDensity(selected, u, v), 10.0);
+                    cell.weightF[i] = float(cell.weightF[i] * jacobian);
+                }
+            }
+
+            for (uint32_t c = 0; c < 3; c++) std::fill(cell.vPos[c].begin(), cell.vPos[c].end(), kReceiver[c]);
+        }
+
+        Estimate estimateCell(bool areaMeasure)
+        {
+            Kernels::ReservoirBatch cell;
+            std::vector<float> targetPdf;
+            buildCell(areaMeasure, 1, 0, cell);
+            Kernels::evalTargetPdf(cell, targetPdf);
+            return estimate(cell, targetPdf);
+        }
+    }
+
+    CPU_TEST(CellMergeAreaMeasureUnbiased)
+    {
+        double reference = referenceIntegral();
+        Estimate estimate = estimateCell(true);
+
+        EXPECT_LT(estimate.stdError, 0.01 * reference);
+        EXPECT_LE(std::abs(estimate.mean - reference), 5.0 * estimate.stdError);
+    }
+
+    CPU_TEST(CellMergeSolidAngleBiased)
+    {
+        /// merging solid angle weights taken at different vPos is off by far more than the noise, so the test above can tell
+        double reference = referenceIntegral();
+        Estimate estimate = estimateCell(false);
+
+        EXPECT_GT(std::abs(estimate.mean - reference), 10.0 * estimate.stdError);
+    }
+
+    CPU_TEST(CellReceiverCountsCellOnce)
+    {
+        /// the receiver's own sample plus both cell reservoirs, the way the GI_CELL_RESERVOIRS spatial pass merges them.
+        /// both are built from the same members, so they share the cell's confidence instead of each adding their M
+        const uint32_t receiverM = 4;
+        Kernels::ReservoirBatch cells[2];
+        buildCell(true, 1, 1, cells[0]);
+        buildCell(true, 2, 2, cells[1]);
+        uint32_t cellM = std::max(cells[0].M[0], cells[1].M[0]);
+
+        Kernels::RngBatch rng;
+        seedBatch(rng, 3);
+        Kernels::ReservoirBatch receiver, dst;
+        receiver.resize(kTrials);
+        dst.resize(kTrials);
+        drawEmitterSample(rng, kReceiver, receiverM, receiver);
+
+        std::vector<float> weightS(kTrials, 0.f);
+        std::vector<float> targetPdf;
+        Kernels::evalTargetPdf(receiver, targetPdf);
+        Kernels::merge(dst, weightS, receiver, targetPdf, rng);
+
+        std::vector<float> confidence(kTrials, float(cellM) / 2.f);
+        for (const auto& cell : cells)
+        {
+            Kernels::evalTargetPdf(cell, targetPdf);
+            Kernels::merge(dst, weightS, cell, targetPdf, rng, nullptr, &confidence);
+        }
+        EXPECT_EQ(dst.M[0], receiverM);
+        for (size_t i = 0; i < kTrials; i++) dst.M[i] += cellM;
+
+        Kernels::evalTargetPdf(dst, targetPdf);
+        Kernels::computeFinalWeight(dst, targetPdf, weightS);
+
+        double reference = referenceIntegral();
+        Estimate result = estimate(dst, targetPdf);
+        EXPECT_EQ(dst.M[0], receiverM + cellM);
+        EXPECT_LT(result.stdError, 0.01 * reference);
+        EXPECT_LE(std::abs(result.mean - reference), 5.0 * result.stdError);
+    }
+}
@@ -0,0 +1,129 @@
+#include "Testing/UnitTest.h"
+#include "Experimental/WorldSpaceReSTIRGI/GIStageGraph.h"
+
+namespace Falcor
+{
+    namespace
+    {
+        /// the graph only compares resource addresses, it never dereferences them
+        const Resource* fakeResource(uintptr_t id) { return reinterpret_cast<const Resource*>(0x1000 + id * 0x100); }
+
+        GIStageGraph::ExecuteFunc record(std::vector<uint32_t>& order, uint32_t stage)
+        {
+            return [&order, stage](RenderContext*) { order.push_back(stage); };
+        }
+
+        bool dependsOn(const GIStageGraph& graph, uint32_t stage, uint32_t dependency)
+        {
+            const auto& deps = graph.getDependencies(stage);
+            return std::find(deps.begin(), deps.end(), dependency) != deps.end();
+        }
+
+        uint32_t levelOf(const GIStageGraph& graph, uint32_t stage)
+        {
+            const auto& levels = graph.getLevels();
+            for (uint32_t l = 0; l < levels.size(); l++)
+            {
+                if (std::find(levels[l].begin(), levels[l].end(), stage) != levels[l].end()) return l;
+            }
+            return ~0u;
+        }
+    }
+
+    CPU_TEST(StageGraphHazards)
+    {
+        const Resource* a = fakeResource(0);
+        const Resource* b = fakeResource(1);
+        const Resource* c = fakeResource(2);
+
+        auto graph = GIStageGraph::create();
+        std::vector<uint32_t> order;
+        uint32_t writeA = graph->addStage("WriteA", {}, { a }, record(order, 0));
+        uint32_t readA = graph->addStage("ReadA", { a }, { b }, record(order, 1));          /// RAW on a
+        uint32_t writeC = graph->addStage("WriteC", {}, { c }, record(order, 2));           /// independent
+        uint32_t overwriteA = graph->addStage("OverwriteA", {}, { a }, record(order, 3));   /// WAR with ReadA, WAW with WriteA
+        uint32_t writeB = graph->addStage("WriteB", {}, { b }, record(order, 4));           /// WAW on b
+        graph->compile();
+
+        EXPECT(graph->validate());
+        EXPECT(graph->getDependencies(writeA).empty());
+        EXPECT(graph->getDependencies(writeC).empty());
+
+        EXPECT_EQ(graph->getDependencies(readA).size(), 1u);
+        EXPECT(dependsOn(*graph, readA, writeA));
+
+        EXPECT_EQ(graph->getDependencies(overwriteA).size(), 2u);
+        EXPECT(dependsOn(*graph, overwriteA, readA));
+        EXPECT(dependsOn(*graph, overwriteA, writeA));
+
+        EXPECT_EQ(graph->getDependencies(writeB).size(), 1u);
+        EXPECT(dependsOn(*graph, writeB, readA));
+
+        const auto& levels = graph->getLevels();
+        EXPECT_EQ(levels.size(), 3u);
+        EXPECT_EQ(levelOf(*graph, writeA), 0u);
+        EXPECT_EQ(levelOf(*graph, writeC), 0u);
+        EXPECT_EQ(levelOf(*graph, readA), 1u);
+        EXPECT_EQ(levelOf(*graph, overwriteA), 2u);
+        EXPECT_EQ(levelOf(*graph, writeB), 2u);
+
+        graph->execute(nullptr);
+        EXPECT_EQ(order.size(), 5u);
+        EXPECT(order == std::vector<uint32_t>({ 0, 2, 1, 3, 4 }));
+    }
+
+    CPU_TEST(StageGraphWriteClearsReaders)
+    {
+        const Resource* a = fakeResource(0);
+
+        auto graph = GIStageGraph::create();
+        std::vector<uint32_t> order;
+        uint32_t read0 = graph->addStage("Read0", { a }, {}, record(order, 0));
+        uint32_t write = graph->addStage("Write", {}, { a }, record(order, 1));
+        uint32_t read1 = graph->addStage("Read1", { a }, {}, record(order, 2));
+        uint32_t rewrite = graph->addStage("Rewrite", {}, { a }, record(order, 3));
+        graph->compile();
+
+        EXPECT(graph->validate());
+        EXPECT(graph->getDependencies(read0).empty());
+        EXPECT(dependsOn(*graph, write, read0));
+        EXPECT_EQ(graph->getDependencies(read1).size(), 1u);
+        EXPECT(dependsOn(*graph, read1, write));
+
+        /// Read0 was covered by Write, only the readers since then are waited on
+        EXPECT_EQ(graph->getDependencies(rewrite).size(), 2u);
+        EXPECT(dependsOn(*graph, rewrite, read1));
+        EXPECT(dependsOn(*graph, rewrite, write));
+        EXPECT(!dependsOn(*graph, rewrite, read0));
+    }
+
+    CPU_TEST(StageGraphTiles)
+    {
+        /// two tiles the way the pass records them: the tile buffers are shared, outputColor is only written by shading
+        const Resource* vbuffer = fakeResource(0);
+        const Resource* outputColor = fakeResource(1);
+        const Resource* traced = fakeResource(2);
+        const Resource* finalSample = fakeResource(3);
+
+        auto graph = GIStageGraph::create();
+        uint32_t trace[2], resample[2], shade[2];
+        for (uint32_t tile = 0; tile < 2; tile++)
+        {
+            trace[tile] = graph->addStage("TracePath", { vbuffer }, { traced }, {});
+            resample[tile] = graph->addStage("FinalSample", { traced }, { finalSample }, {});
+            shade[tile] = graph->addStage("FinalShading", { vbuffer, traced, finalSample }, { outputColor }, {});
+        }
+        graph->compile();
+
+        EXPECT(graph->validate());
+        EXPECT_EQ(levelOf(*graph, trace[0]), 0u);
+        EXPECT(dependsOn(*graph, resample[0], trace[0]));
+        EXPECT(dependsOn(*graph, shade[0], resample[0]));
+
+        /// the next tile overwrites what this tile's shading reads, the write-after-read keeps it behind
+        EXPECT(dependsOn(*graph, trace[1], shade[0]));
+        EXPECT(dependsOn(*graph, resample[1], shade[0]));
+        EXPECT(dependsOn(*graph, shade[1], shade[0]));
+        EXPECT_EQ(graph->getLevels().size(), 6u);
+    }
+}
@@ -0,0 +1,119 @@
+#include "Testing/UnitTest.h"
+#include "Experimental/WorldSpaceReSTIRGI/HashInsertionSimulator.h"
+#include <filesystem>
+
+namespace Falcor
+{
+    namespace
+    {
+        /// 8x8 pixel cells, the last column of cells is invalid. a cell's slot is probeDepth(cell) deep into its bucket
+        const uint2 kFrameDim = uint2(64, 32);
+        const uint32_t kCellSize = 8;
+        const uint32_t kValidCellsX = 7;
+
+        uint32_t probeDepth(uint32_t cellX, uint32_t cellY) { return (cellX + cellY) % 3; }
+
+        HashInsertionSimulator::Frame createFrame(uint2 tileDim)
+        {
+            HashInsertionSimulator::Frame frame;
+            frame.frameDim = kFrameDim;
+            frame.tileDim = tileDim;
+            frame.data.resize(kFrameDim.x * kFrameDim.y);
+
+            for (uint32_t y = 0; y < kFrameDim.y; y++)
+            {
+                for (uint32_t x = 0; x < kFrameDim.x; x++)
+                {
+                    uint32_t cellX = x / kCellSize;
+                    uint32_t cellY = y / kCellSize;
+                    auto& data = frame.data[y * kFrameDim.x + x];
+                    data.reservoirIdx = y * kFrameDim.x + x;
+                    if (cellX >= kValidCellsX) continue;
+
+                    data.isValid = 1;
+                    data.cellIdx = (cellY * kFrameDim.x / kCellSize + cellX) * HashInsertionSimulator::kBucketSize + probeDepth(cellX, cellY);
+                }
+            }
+            return frame;
+        }
+
+        uint64_t expectedPerLaneProbes()
+        {
+            uint64_t probes = 0;
+            for (uint32_t y = 0; y < kFrameDim.y; y++)
+            {
+                for (uint32_t x = 0; x < kValidCellsX * kCellSize; x++) probes += probeDepth(x / kCellSize, y / kCellSize) + 1;
+            }
+            return probes;
+        }
+    }
+
+    CPU_TEST(HashInsertionPerWave)
+    {
+        HashInsertionSimulator::Frame frame = createFrame(kFrameDim);
+        HashInsertionSimulator::Stats stats = HashInsertionSimulator::simulate(frame, 32);
+
+        /// a wave of 32 is two rows of a 16x16 group, so it covers two cells side by side (one in the last group column)
+        uint64_t validLanes = kValidCellsX * kCellSize * kFrameDim.y;
+        uint64_t cooperativeProbes = 0;
+        for (uint32_t rowPair = 0; rowPair < kFrameDim.y / 2; rowPair++)
+        {
+            for (uint32_t cellX = 0; cellX < kValidCellsX; cellX++) cooperativeProbes += probeDepth(cellX, rowPair * 2 / kCellSize) + 1;
+        }
+
+        EXPECT_EQ(stats.waves, 64u);
+        EXPECT_EQ(stats.validLanes, validLanes);
+        EXPECT_EQ(stats.perLaneAdds, validLanes);
+        EXPECT_EQ(stats.perLaneProbes, expectedPerLaneProbes());
+        EXPECT_EQ(stats.cooperativeAdds, 112u);
+        EXPECT_EQ(stats.cooperativeProbes, cooperativeProbes);
+        EXPECT_EQ(stats.maxCellsPerWave, 2u);
+
+        /// a wave of 64 spans four rows, still inside one cell row
+        HashInsertionSimulator::Stats stats64 = HashInsertionSimulator::simulate(frame, 64);
+        EXPECT_EQ(stats64.waves, 32u);
+        EXPECT_EQ(stats64.perLaneAdds, validLanes);
+        EXPECT_EQ(stats64.cooperativeAdds, 56u);
+    }
+
+    CPU_TEST(HashInsertionTiled)
+    {
+        /// tiles move the group origin, which lanes share a wave changes but the per-lane atomics don't
+        HashInsertionSimulator::Stats full = HashInsertionSimulator::simulate(createFrame(kFrameDim), 32);
+        HashInsertionSimulator::Stats tiled = HashInsertionSimulator::simulate(createFrame(uint2(20, 20)), 32);
+
+        EXPECT_EQ(tiled.validLanes, full.validLanes);
+        EXPECT_EQ(tiled.perLaneProbes, full.perLaneProbes);
+        EXPECT_EQ(tiled.perLaneAdds, full.perLaneAdds);
+        EXPECT_GT(tiled.cooperativeAdds, full.cooperativeAdds);
+        EXPECT_LE(tiled.cooperativeAdds, tiled.perLaneAdds);
+        EXPECT_LE(tiled.cooperativeProbes, tiled.perLaneProbes);
+    }
+
+    CPU_TEST(HashInsertionReplayDump)
+    {
+        std::string path = (std::filesystem::temp_directory_path() / "HashInsertionReplayDump.bin").string();
+
+        HashInsertionSimulator::Frame frame = createFrame(uint2(32, 32));
+        EXPECT(HashInsertionSimulator::save(path, frame));
+
+        HashInsertionSimulator::Frame loaded;
+        EXPECT(HashInsertionSimulator::load(path, loaded));
+        EXPECT_EQ(loaded.frameDim.x, frame.frameDim.x);
+        EXPECT_EQ(loaded.frameDim.y, frame.frameDim.y);
+        EXPECT_EQ(loaded.tileDim.x, frame.tileDim.x);
+        EXPECT_EQ(loaded.tileDim.y, frame.tileDim.y);
+
+        HashInsertionSimulator::Stats expected = HashInsertionSimulator::simulate(frame, 32);
+        HashInsertionSimulator::Stats replayed = HashInsertionSimulator::simulate(loaded, 32);
+        EXPECT_EQ(replayed.waves, expected.waves);
+        EXPECT_EQ(replayed.perLaneProbes, expected.perLaneProbes);
+        EXPECT_EQ(replayed.cooperativeProbes, expected.cooperativeProbes);
+        EXPECT_EQ(replayed.cooperativeAdds, expected.cooperativeAdds);
+
+        /// a truncated dump is rejected rather than replayed short
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) / 2);
+        EXPECT(!HashInsertionSimulator::load(path, loaded));
+        std::filesystem::remove(path);
+    }
+}
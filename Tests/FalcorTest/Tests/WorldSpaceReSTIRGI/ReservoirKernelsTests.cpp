@@ -0,0 +1,336 @@
+#include "Testing/UnitTest.h"
+#include "Experimental/WorldSpaceReSTIRGI/ReservoirKernels.h"
+#include <chrono>
+#include <cstring>
+#include <random>
+
+namespace Falcor
+{
+    namespace
+    {
+        using Kernels = ReservoirKernels;
+
+        /// not a multiple of any simd width and more than one task, so tails and the worker pool are both exercised
+        const size_t kLaneCount = 100003;
+
+        std::vector<Kernels::Isa> supportedIsas()
+        {
+            std::vector<Kernels::Isa> isas;
+            for (uint32_t i = 0; i <= uint32_t(Kernels::getSupportedIsa()); i++) isas.push_back(Kernels::Isa(i));
+            return isas;
+        }
+
+        void randomBatch(std::mt19937& gen, size_t count, Kernels::ReservoirBatch& batch)
+        {
+            std::uniform_real_distribution<float> pos(-5.f, 5.f);
+            std::uniform_real_distribution<float> unit(-1.f, 1.f);
+            std::uniform_real_distribution<float> radiance(0.f, 4.f);
+            std::uniform_real_distribution<float> weight(-0.5f, 8.f);
+            std::uniform_int_distribution<uint32_t> M(0, 40);
+
+            auto normal = [&](std::vector<float> n[3], size_t i)
+            {
+                float v[3] = { unit(gen), unit(gen), unit(gen) + 1.5f };
+                float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+                for (uint32_t c = 0; c < 3; c++) n[c][i] = v[c] / length;
+            };
+
+            batch.resize(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                    batch.vPos[c][i] = pos(gen);
+                    batch.sPos[c][i] = pos(gen);
+                    batch.radiance[c][i] = radiance(gen);
+                }
+                normal(batch.vNorm, i);
+                normal(batch.sNorm, i);
+                batch.M[i] = M(gen);
+                batch.weightF[i] = weight(gen);
+                batch.age[i] = int32_t(i % 100);
+            }
+        }
+
+        void seedBatch(Kernels::RngBatch& rng, size_t count)
+        {
+            rng.resize(count);
+            for (size_t i = 0; i < count; i++) rng.seed(i, uint2(uint32_t(i % 1920), uint32_t(i / 1920)), 17);
+        }
+
+        template<typename T>
+        bool bitEqual(const std::vector<T>& a, const std::vector<T>& b)
+        {
+            return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+        }
+
+        bool bitEqual(const Kernels::ReservoirBatch& a, const Kernels::ReservoirBatch& b)
+        {
+            bool equal = bitEqual(a.M, b.M) && bitEqual(a.weightF, b.weightF) && bitEqual(a.age, b.age);
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                equal = equal && bitEqual(a.vPos[c], b.vPos[c]) && bitEqual(a.vNorm[c], b.vNorm[c]) && bitEqual(a.sPos[c], b.sPos[c]);
+                equal = equal && bitEqual(a.sNorm[c], b.sNorm[c]) && bitEqual(a.radiance[c], b.radiance[c]);
+            }
+            return equal;
+        }
+
+        /// everything the kernels produce for one isa, compared bit for bit against the scalar path
+        struct KernelResults
+        {
+            Kernels::ReservoirBatch merged;
+            std::vector<float> weightS;
+            std::vector<float> reconnectionPdf;
+            std::vector<uint32_t> reconnectionMask;
+            Kernels::ReservoirBatch areaMeasure;
+        };
+
+        KernelResults runKernels(Kernels::Isa isa)
+        {
+            Kernels::setIsa(isa);
+
+            std::mt19937 gen(1234);
+            Kernels::ReservoirBatch dst, src, receiver;
+            randomBatch(gen, kLaneCount, dst);
+            randomBatch(gen, kLaneCount, src);
+            randomBatch(gen, kLaneCount, receiver);
+
+            std::vector<uint32_t> mask(kLaneCount);
+            for (size_t i = 0; i < kLaneCount; i++) mask[i] = i % 7 == 3 ? 0u : 1u;
+
+            Kernels::RngBatch rng;
+            seedBatch(rng, kLaneCount);
+
+            KernelResults results;
+            std::vector<float> targetPdf;
+            Kernels::evalTargetPdf(dst, targetPdf);
+            results.weightS.resize(kLaneCount);
+            for (size_t i = 0; i < kLaneCount; i++) results.weightS[i] = dst.M[i] * std::max(0.f, dst.weightF[i]) * targetPdf[i];
+
+            Kernels::evalTargetPdf(src, targetPdf);
+            Kernels::merge(dst, results.weightS, src, targetPdf, rng, &mask);
+            Kernels::merge(dst, results.weightS, receiver, targetPdf, rng);
+            Kernels::evalTargetPdf(dst, targetPdf);
+            Kernels::computeFinalWeight(dst, targetPdf, results.weightS);
+            results.merged = dst;
+
+            Kernels::evalReconnection(receiver, src, 0.5f, results.reconnectionPdf, results.reconnectionMask);
+
+            results.areaMeasure = src;
+            Kernels::toAreaMeasure(results.areaMeasure);
+            Kernels::toSolidAngle(results.areaMeasure);
+            return results;
+        }
+
+        /// discrete domain for the resampling check: candidates are drawn from sourcePdf, resampled towards value
+        const uint32_t kDomainSize = 8;
+        const uint32_t kCandidateCount = 3;
+        const float kValue[kDomainSize] = { 0.2f, 1.5f, 0.7f, 3.0f, 0.05f, 2.2f, 0.9f, 1.1f };
+        const float kSourcePdf[kDomainSize] = { 0.05f, 0.1f, 0.2f, 0.05f, 0.3f, 0.1f, 0.1f, 0.1f };
+
+        float targetPdf(uint32_t x)
+        {
+            /// same luminance the kernels evaluate for a gray radiance
+            return kValue[x] * 0.299f + kValue[x] * 0.587f + kValue[x] * 0.114f;
+        }
+    }
+
+    CPU_TEST(ReservoirKernelsIsaMatch)
+    {
+        Kernels::Isa supported = Kernels::getSupportedIsa();
+        KernelResults reference = runKernels(Kernels::Isa::Scalar);
+
+        for (Kernels::Isa isa : supportedIsas())
+        {
+            if (isa == Kernels::Isa::Scalar) continue;
+            KernelResults results = runKernels(isa);
+            EXPECT(Kernels::getIsa() == isa);
+            EXPECT(bitEqual(results.merged, reference.merged));
+            EXPECT(bitEqual(results.weightS, reference.weightS));
+            EXPECT(bitEqual(results.reconnectionPdf, reference.reconnectionPdf));
+            EXPECT(bitEqual(results.reconnectionMask, reference.reconnectionMask));
+            EXPECT(bitEqual(results.areaMeasure, reference.areaMeasure));
+        }
+
+        Kernels::setIsa(supported);
+    }
+
+    CPU_TEST(ReservoirKernelsRngMatchesSampleGenerator)
+    {
+        /// sampleNext1D(SampleGenerator(pixel, sampleNumber)) * 2^24 for the first four draws, from an independent
+        /// implementation of UniformSampleGenerator (splitmix64 seeding, xoshiro128**)
+        struct Reference
+        {
+            uint2 pixel;
+            uint32_t sampleNumber;
+            uint32_t values[4];
+        };
+        const Reference kReferences[] =
+        {
+            { uint2(0, 0), 0u, { 0x1e93e3, 0xa6a5a9, 0x24a3a7, 0x9ccb9a } },
+            { uint2(1, 0), 0u, { 0xed1b6c, 0x43f06c, 0xcbf766, 0x7c535b } },
+            { uint2(0, 1), 7u, { 0x8c3cc1, 0xcf4d1c, 0xee11b3, 0xa85cdd } },
+            { uint2(1920, 1080), 3u, { 0x6d7553, 0x42a8dd, 0x2af123, 0xa2cb03 } },
+            { uint2(65535, 65535), 0xffffffffu, { 0x6460d2, 0x2204b9, 0xfc8a3a, 0x6f7046 } },
+        };
+
+        Kernels::RngBatch rng;
+        rng.resize(std::size(kReferences));
+        for (size_t lane = 0; lane < std::size(kReferences); lane++) rng.seed(lane, kReferences[lane].pixel, kReferences[lane].sampleNumber);
+
+        /// lanes are drawn interleaved, each stream has to stay independent of its neighbors
+        for (uint32_t draw = 0; draw < 4; draw++)
+        {
+            for (size_t lane = 0; lane < std::size(kReferences); lane++)
+            {
+                EXPECT_EQ(uint32_t(rng.next1D(lane) * 16777216.f), kReferences[lane].values[draw]);
+            }
+        }
+    }
+
+    CPU_TEST(ReservoirKernelsResamplingExpectation)
+    {
+        /// brute force over every combination of candidates: probability of the combination and of each selection
+        /// against the weight the merge would assign, gives the exact expectation of weightF and of f * weightF
+        double expectedWeight = 0.0;
+        double expectedEstimate = 0.0;
+        uint32_t combinationCount = 1;
+        for (uint32_t i = 0; i < kCandidateCount; i++) combinationCount *= kDomainSize;
+
+        for (uint32_t combination = 0; combination < combinationCount; combination++)
+        {
+            uint32_t x[kCandidateCount];
+            double probability = 1.0;
+            double weightSum = 0.0;
+            for (uint32_t i = 0, c = combination; i < kCandidateCount; i++, c /= kDomainSize)
+            {
+                x[i] = c % kDomainSize;
+                probability *= kSourcePdf[x[i]];
+                weightSum += targetPdf(x[i]) / kSourcePdf[x[i]];
+            }
+            for (uint32_t i = 0; i < kCandidateCount; i++)
+            {
+                double selection = targetPdf(x[i]) / kSourcePdf[x[i]] / weightSum;
+                double W = weightSum / (targetPdf(x[i]) * kCandidateCount);
+                expectedWeight += probability * selection * W;
+                expectedEstimate += probability * selection * W * kValue[x[i]];
+            }
+        }
+
+        double integral = 0.0;
+        for (uint32_t x = 0; x < kDomainSize; x++) integral += kValue[x];
+        EXPECT_LT(std::abs(expectedEstimate - integral), 1e-4 * integral);
+
+        const size_t trials = 1 << 18;
+        Kernels::ReservoirBatch merged, candidate;
+        Kernels::RngBatch rng;
+        merged.resize(trials);
+        candidate.resize(trials);
+        seedBatch(rng, trials);
+
+        std::vector<float> weightS(trials, 0.f);
+        std::vector<float> pdf;
+        for (uint32_t i = 0; i < kCandidateCount; i++)
+        {
+            for (size_t lane = 0; lane < trials; lane++)
+            {
+                float u = rng.next1D(lane);
+                uint32_t x = 0;
+                for (float cdf = kSourcePdf[0]; x + 1 < kDomainSize && u >= cdf; cdf += kSourcePdf[++x]) {}
+
+                for (uint32_t c = 0; c < 3; c++) candidate.radiance[c][lane] = kValue[x];
+                candidate.M[lane] = 1;
+                candidate.weightF[lane] = 1.f / kSourcePdf[x];
+            }
+            Kernels::evalTargetPdf(candidate, pdf);
+            Kernels::merge(merged, weightS, candidate, pdf, rng);
+        }
+        Kernels::evalTargetPdf(merged, pdf);
+        Kernels::computeFinalWeight(merged, pdf, weightS);
+
+        double sumW = 0.0, sumW2 = 0.0, sumF = 0.0, sumF2 = 0.0;
+        for (size_t lane = 0; lane < trials; lane++)
+        {
+            double W = merged.weightF[lane];
+            double F = merged.radiance[0][lane] * W;
+            sumW += W;
+            sumW2 += W * W;
+            sumF += F;
+            sumF2 += F * F;
+        }
+        double meanW = sumW / trials;
+        double meanF = sumF / trials;
+        double errorW = std::sqrt((sumW2 / trials - meanW * meanW) / trials);
+        double errorF = std::sqrt((sumF2 / trials - meanF * meanF) / trials);
+
+        EXPECT_EQ(merged.M[0], kCandidateCount);
+        EXPECT_LE(std::abs(meanW - expectedWeight), 5.0 * errorW);
+        EXPECT_LE(std::abs(meanF - expectedEstimate), 5.0 * errorF);
+    }
+
+    CPU_TEST(ReservoirKernelsBenchmark)
+    {
+        /// timings only, logged per isa. 4M lanes of the spatial reuse inner loop: reconnection, merge, final weight
+        const size_t laneCount = 1 << 22;
+        Kernels::Isa supported = Kernels::getSupportedIsa();
+
+        std::mt19937 gen(99);
+        Kernels::ReservoirBatch receiver, neighbor;
+        randomBatch(gen, laneCount, receiver);
+        randomBatch(gen, laneCount, neighbor);
+
+        double scalarMs = 0.0;
+        for (Kernels::Isa isa : supportedIsas())
+        {
+            Kernels::setIsa(isa);
+
+            Kernels::ReservoirBatch dst = receiver;
+            Kernels::RngBatch rng;
+            seedBatch(rng, laneCount);
+            std::vector<float> weightS(laneCount, 0.f);
+            std::vector<float> targetPdf;
+            std::vector<uint32_t> mask;
+
+            /// the first call starts the worker pool, keep it out of the timing
+            Kernels::evalTargetPdf(dst, targetPdf);
+
+            const uint32_t repetitions = 5;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t r = 0; r < repetitions; r++)
+            {
+                Kernels::evalReconnection(receiver, neighbor, 0.5f, targetPdf, mask);
+                Kernels::merge(dst, weightS, neighbor, targetPdf, rng, &mask);
+                Kernels::evalTargetPdf(dst, targetPdf);
+                Kernels::computeFinalWeight(dst, targetPdf, weightS);
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repetitions;
+            if (isa == Kernels::Isa::Scalar) scalarMs = ms;
+
+            const char* kIsaNames[] = { "scalar", "sse", "avx2" };
+            logInfo(std::string("ReservoirKernels ") + kIsaNames[uint32_t(isa)] + ": " + std::to_string(ms) + " ms per pass, "
+                + std::to_string(laneCount / ms * 1e-3) + " M lanes/s, " + std::to_string(scalarMs / ms) + "x scalar");
+            EXPECT_GT(ms, 0.0);
+        }
+
+        Kernels::setIsa(supported);
+        Kernels::shutdown();
+    }
+
+    CPU_TEST(ReservoirKernelsShutdown)
+    {
+        /// large enough to be split into tasks, so both calls go through a worker pool
+        const size_t laneCount = 1 << 18;
+        std::mt19937 gen(7);
+        Kernels::ReservoirBatch batch;
+        randomBatch(gen, laneCount, batch);
+
+        std::vector<float> before, after;
+        Kernels::evalTargetPdf(batch, before);
+        Kernels::shutdown();
+        Kernels::shutdown();        /// stopping an already stopped pool does nothing
+        Kernels::evalTargetPdf(batch, after);
+        Kernels::shutdown();
+
+        EXPECT(bitEqual(before, after));
+    }
+}